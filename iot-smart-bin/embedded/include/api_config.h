@@ -11,6 +11,18 @@ namespace MQTT
             return String("bins/") + deviceId + "/data";
         }
 
+        // Summary Topic: bins/{id}/summary
+        inline String getSummary(const char *deviceId)
+        {
+            return String("bins/") + deviceId + "/summary";
+        }
+
+        // Metrics Topic: bins/{id}/metrics
+        inline String getMetrics(const char *deviceId)
+        {
+            return String("bins/") + deviceId + "/metrics";
+        }
+
         // Status Topic: bins/{id}/status
         inline String getStatus(const char *deviceId)
         {
@@ -23,12 +35,36 @@ namespace MQTT
             return String("bins/") + deviceId + "/config";
         }
 
+        // Group Config Topic: bins/group/{group}/config
+        inline String getGroupConfig(const char *group)
+        {
+            return String("bins/group/") + group + "/config";
+        }
+
+        // Fleet Config Topic: bins/all/config
+        inline String getFleetConfig()
+        {
+            return String("bins/all/config");
+        }
+
         // Request Config Topic: bins/{DEVICE_ID}/get-config
         inline String requestConfig(const char *deviceId)
         {
             return String("bins/") + deviceId + "/get-config";
         }
 
+        // Calibration Result Topic: bins/{id}/calibration
+        inline String getCalibration(const char *deviceId)
+        {
+            return String("bins/") + deviceId + "/calibration";
+        }
+
+        // Calibrate Command Topic: cmd/calibrate/{id}
+        inline String getCalibrate(const char *deviceId)
+        {
+            return String("cmd/calibrate/") + deviceId;
+        }
+
         // Ping Topic: cmd/ping/{id}
         inline String getPing(const char *deviceId)
         {
@@ -0,0 +1,126 @@
+#include "BinGeometry.h"
+#include <math.h>
+
+// Speed of sound at ~19°C, the HCSR04 library's default
+static const float SPEED_OF_SOUND_CM_PER_US = 0.0343f;
+
+static float clampPercent(float value)
+{
+    if (value < 0)
+        return 0;
+    if (value > 100)
+        return 100;
+    return value;
+}
+
+BinGeometry::BinGeometry(float emptyDistanceCm, float rangeMargin)
+    : _emptyDistanceCm(emptyDistanceCm), _rangeMargin(rangeMargin), _tableSize(0)
+{
+}
+
+void BinGeometry::setEmptyDistanceCm(float emptyDistanceCm)
+{
+    _emptyDistanceCm = emptyDistanceCm;
+}
+
+float BinGeometry::getEmptyDistanceCm() const
+{
+    return _emptyDistanceCm;
+}
+
+uint16_t BinGeometry::getMaxRangeCm() const
+{
+    float range = _emptyDistanceCm * (1.0f + _rangeMargin);
+    // A table may describe a bin deeper than the calibrated floor (e.g. a liner)
+    if (_tableSize > 0 && _table[_tableSize - 1].distanceCm > range)
+        range = _table[_tableSize - 1].distanceCm;
+    return (uint16_t)ceilf(range);
+}
+
+uint32_t BinGeometry::getEchoTimeoutUs() const
+{
+    // Round trip (x2) plus 25% margin, as in UltraSonicDistanceSensor::measureDistanceCm
+    return (uint32_t)(2.5f * getMaxRangeCm() / SPEED_OF_SOUND_CM_PER_US);
+}
+
+bool BinGeometry::setVolumeTable(const VolumePoint *points, uint8_t count)
+{
+    if (count == 0)
+    {
+        _tableSize = 0;
+        return true;
+    }
+    if (count < 2)
+        return false;
+
+    VolumePoint sorted[MAX_POINTS];
+    uint8_t size = 0;
+    for (uint8_t i = 0; i < count && size < MAX_POINTS; i++)
+    {
+        // Insertion sort by distance, dropping duplicate distances
+        uint8_t j = size;
+        while (j > 0 && sorted[j - 1].distanceCm > points[i].distanceCm)
+        {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        if (j > 0 && sorted[j - 1].distanceCm == points[i].distanceCm)
+        {
+            // Undo the shift
+            for (uint8_t k = j; k < size; k++)
+                sorted[k] = sorted[k + 1];
+            continue;
+        }
+        sorted[j] = points[i];
+        size++;
+    }
+
+    if (size < 2)
+        return false;
+
+    // Farther from the sensor must never mean fuller
+    for (uint8_t i = 1; i < size; i++)
+    {
+        if (sorted[i].fillPercent > sorted[i - 1].fillPercent)
+            return false;
+    }
+
+    for (uint8_t i = 0; i < size; i++)
+        _table[i] = sorted[i];
+    _tableSize = size;
+    return true;
+}
+
+uint8_t BinGeometry::getVolumeTableSize() const
+{
+    return _tableSize;
+}
+
+const VolumePoint *BinGeometry::getVolumeTable() const
+{
+    return _table;
+}
+
+float BinGeometry::toFillPercent(float distanceCm) const
+{
+    if (_tableSize == 0)
+    {
+        if (_emptyDistanceCm <= 0)
+            return 0;
+        return clampPercent(100.0f * (1.0f - distanceCm / _emptyDistanceCm));
+    }
+
+    if (distanceCm <= _table[0].distanceCm)
+        return clampPercent(_table[0].fillPercent);
+    if (distanceCm >= _table[_tableSize - 1].distanceCm)
+        return clampPercent(_table[_tableSize - 1].fillPercent);
+
+    uint8_t i = 1;
+    while (_table[i].distanceCm < distanceCm)
+        i++;
+
+    const VolumePoint &near = _table[i - 1];
+    const VolumePoint &far = _table[i];
+    float t = (distanceCm - near.distanceCm) / (far.distanceCm - near.distanceCm);
+    return clampPercent(near.fillPercent + t * (far.fillPercent - near.fillPercent));
+}
@@ -0,0 +1,67 @@
+#ifndef BIN_GEOMETRY_H
+#define BIN_GEOMETRY_H
+
+#include <stdint.h>
+
+/**
+ * One point of a bin's distance -> volume curve.
+ * distanceCm is measured from the sensor, fillPercent is the share of the bin's volume that is full.
+ */
+struct VolumePoint
+{
+    float distanceCm;
+    float fillPercent;
+};
+
+/**
+ * Maps a measured distance to a fill percentage using the calibrated empty-bin distance,
+ * and optionally a lookup table for tapered bins where fill height and volume are not linear.
+ */
+class BinGeometry
+{
+public:
+    static const uint8_t MAX_POINTS = 16;
+
+    /**
+     * @param emptyDistanceCm Distance from the sensor to the bottom of the empty bin.
+     * @param rangeMargin Extra range above the empty distance that still counts as a valid echo (0.1 = 10%).
+     */
+    BinGeometry(float emptyDistanceCm, float rangeMargin = 0.1);
+
+    void setEmptyDistanceCm(float emptyDistanceCm);
+    float getEmptyDistanceCm() const;
+
+    /**
+     * Farthest distance worth waiting for an echo from. Anything beyond is a miss.
+     */
+    uint16_t getMaxRangeCm() const;
+
+    /**
+     * Echo timeout for getMaxRangeCm(), with the same 25% margin the HCSR04 library applies.
+     */
+    uint32_t getEchoTimeoutUs() const;
+
+    /**
+     * Replaces the lookup table. Points are sorted by distance; duplicates and extra points are dropped.
+     * A count of 0 clears the table and falls back to the linear mapping.
+     * @returns false if the table was rejected (fewer than two points or fill not decreasing with distance).
+     */
+    bool setVolumeTable(const VolumePoint *points, uint8_t count);
+    uint8_t getVolumeTableSize() const;
+    const VolumePoint *getVolumeTable() const;
+
+    /**
+     * Fill percentage (0-100) for a measured distance.
+     * Without a table: 100% at the sensor, 0% at the empty distance.
+     * With a table: linear interpolation between points, clamped to the end points.
+     */
+    float toFillPercent(float distanceCm) const;
+
+private:
+    float _emptyDistanceCm;
+    float _rangeMargin;
+    VolumePoint _table[MAX_POINTS];
+    uint8_t _tableSize;
+};
+
+#endif
@@ -18,6 +18,11 @@ UltraSonicDistanceSensor::UltraSonicDistanceSensor(
     pinMode(echoPin, INPUT);
 }
 
+void UltraSonicDistanceSensor::setMaxDistanceCm(unsigned short maxDistanceCm)
+{
+    this->maxDistanceCm = maxDistanceCm;
+}
+
 float UltraSonicDistanceSensor::measureDistanceCm()
 {
     // Using the approximate formula 19.307°C results in roughly 343m/s which is the commonly used value for air.
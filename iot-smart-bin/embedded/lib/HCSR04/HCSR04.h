@@ -43,6 +43,12 @@ public:
    */
   float measureDistanceCm(float temperature);
 
+  /**
+   * Changes the maximum distance (and therefore the echo timeout) after construction,
+   * e.g. once the real depth of the installation is known.
+   */
+  void setMaxDistanceCm(unsigned short maxDistanceCm);
+
 private:
   byte triggerPin, echoPin;
   unsigned short maxDistanceCm;
@@ -0,0 +1,100 @@
+#include "HampelFilter.h"
+
+// Scales the MAD to a standard deviation estimate for normally distributed data
+static const float MAD_SCALE = 1.4826;
+
+HampelFilter::HampelFilter(uint8_t windowSize, float nSigmas, float minDeviation)
+{
+    if (windowSize < 3)
+        windowSize = 3;
+    if (windowSize > MAX_WINDOW)
+        windowSize = MAX_WINDOW;
+
+    _windowSize = windowSize;
+    _nSigmas = nSigmas;
+    _minDeviation = minDeviation;
+    _rejectedCount = 0;
+    reset();
+}
+
+void HampelFilter::reset()
+{
+    _count = 0;
+    _head = 0;
+    _lastRejected = false;
+}
+
+/**
+ * Sorts the values in place (insertion sort, tiny N) and returns the middle element.
+ */
+float HampelFilter::median(float *values, uint8_t count)
+{
+    for (uint8_t i = 1; i < count; i++)
+    {
+        float key = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > key)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = key;
+    }
+
+    if (count % 2 == 1)
+        return values[count / 2];
+    return (values[count / 2 - 1] + values[count / 2]) / 2.0f;
+}
+
+float HampelFilter::update(float value)
+{
+    float output = value;
+    _lastRejected = false;
+
+    // Not enough history to judge yet, accept everything
+    if (_count >= 3)
+    {
+        float scratch[MAX_WINDOW];
+        for (uint8_t i = 0; i < _count; i++)
+            scratch[i] = _window[i];
+        float med = median(scratch, _count);
+
+        for (uint8_t i = 0; i < _count; i++)
+        {
+            float diff = _window[i] - med;
+            scratch[i] = diff < 0 ? -diff : diff;
+        }
+        float bound = _nSigmas * MAD_SCALE * median(scratch, _count);
+        if (bound < _minDeviation)
+            bound = _minDeviation;
+
+        float deviation = value - med;
+        if (deviation < 0)
+            deviation = -deviation;
+
+        if (deviation > bound)
+        {
+            output = med;
+            _lastRejected = true;
+            _rejectedCount++;
+        }
+    }
+
+    // Ring buffer insert of the raw value
+    _window[_head] = value;
+    _head = (_head + 1) % _windowSize;
+    if (_count < _windowSize)
+        _count++;
+
+    return output;
+}
+
+bool HampelFilter::wasRejected() const
+{
+    return _lastRejected;
+}
+
+uint32_t HampelFilter::getRejectedCount() const
+{
+    return _rejectedCount;
+}
@@ -0,0 +1,60 @@
+#ifndef HAMPEL_FILTER_H
+#define HAMPEL_FILTER_H
+
+#include <stdint.h>
+
+/**
+ * Streaming Hampel filter over the last K values.
+ * A value is rejected when it lies further than nSigmas * (1.4826 * MAD) from the window median.
+ * Memory is a fixed array of MAX_WINDOW floats and each update is bounded by MAX_WINDOW^2 operations.
+ */
+class HampelFilter
+{
+public:
+    static const uint8_t MAX_WINDOW = 15;
+
+    /**
+     * @param windowSize Number of past values to compare against (clamped to 3..MAX_WINDOW).
+     * @param nSigmas Rejection bound in scaled MADs (3.0 is the classic Hampel identifier).
+     * @param minDeviation Floor on the rejection bound, so a perfectly steady window (MAD = 0)
+     *                     does not reject small sensor jitter. Same units as the input.
+     */
+    HampelFilter(uint8_t windowSize = 5, float nSigmas = 3.0, float minDeviation = 0.0);
+
+    /**
+     * Pushes a new value through the filter.
+     * The raw value is always stored, so a lasting step change is accepted once it fills half the window.
+     * @param value The new raw value.
+     * @returns The value itself, or the window median if the value was rejected as an outlier.
+     */
+    float update(float value);
+
+    /**
+     * Returns true if the last value passed to update() was rejected.
+     */
+    bool wasRejected() const;
+
+    /**
+     * Total number of rejected values since construction (not cleared by reset()).
+     */
+    uint32_t getRejectedCount() const;
+
+    /**
+     * Forgets the window, e.g. after an expected discontinuity such as the bin being emptied.
+     */
+    void reset();
+
+private:
+    float _window[MAX_WINDOW];
+    uint8_t _windowSize;
+    uint8_t _count;
+    uint8_t _head;
+    float _nSigmas;
+    float _minDeviation;
+    bool _lastRejected;
+    uint32_t _rejectedCount;
+
+    static float median(float *values, uint8_t count);
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "LoRaUplink.h"
+#include <math.h>
+
+void packBinReading(const BinReading &reading, uint8_t *buffer)
+{
+    uint8_t fill = reading.fillLevel > 100 ? 100 : reading.fillLevel;
+    uint8_t battery = reading.batteryPercentage > 100 ? 100 : reading.batteryPercentage;
+
+    buffer[0] = (reading.isTilted ? 0x80 : 0x00) | fill;
+    buffer[1] = battery;
+}
+
+bool unpackBinReading(const uint8_t *buffer, uint8_t length, BinReading &reading)
+{
+    if (length < BIN_READING_PACKED_SIZE)
+        return false;
+
+    reading.isTilted = (buffer[0] & 0x80) != 0;
+    reading.fillLevel = buffer[0] & 0x7F;
+    reading.batteryPercentage = buffer[1] & 0x7F;
+    return reading.fillLevel <= 100 && reading.batteryPercentage <= 100;
+}
+
+uint32_t loraAirtimeMs(uint8_t spreadingFactor, uint32_t bandwidthHz, uint8_t phyPayloadLength)
+{
+    const int PREAMBLE_SYMBOLS = 8;
+    const int CODING_RATE = 1; // 4/5
+
+    double symbolMs = (double)(1UL << spreadingFactor) * 1000.0 / bandwidthHz;
+    // Low data rate optimization is mandated when a symbol lasts 16ms or more
+    int lowDataRate = symbolMs >= 16.0 ? 1 : 0;
+
+    double preambleMs = (PREAMBLE_SYMBOLS + 4.25) * symbolMs;
+    double numerator = 8.0 * phyPayloadLength - 4.0 * spreadingFactor + 28 + 16;
+    double denominator = 4.0 * (spreadingFactor - 2 * lowDataRate);
+    double extraSymbols = ceil(numerator / denominator) * (CODING_RATE + 4);
+    if (extraSymbols < 0)
+        extraSymbols = 0;
+    double payloadMs = (8 + extraSymbols) * symbolMs;
+
+    return (uint32_t)ceil(preambleMs + payloadMs);
+}
+
+LoRaUplink::LoRaUplink(LoRaRadio &radio, uint8_t spreadingFactor, float maxDutyCycle, uint32_t dailyAirtimeBudgetMs)
+    : _radio(radio)
+{
+    _spreadingFactor = spreadingFactor;
+    _maxDutyCycle = maxDutyCycle;
+    _dailyAirtimeBudgetMs = dailyAirtimeBudgetMs;
+    _hasPending = false;
+    _hasSent = false;
+    _nextAllowedMs = 0;
+    _dayStartMs = 0;
+    _airtimeUsedTodayMs = 0;
+    _sentCount = 0;
+    _droppedCount = 0;
+}
+
+void LoRaUplink::queue(const BinReading &reading)
+{
+    if (_hasPending)
+        _droppedCount++;
+    _pending = reading;
+    _hasPending = true;
+}
+
+bool LoRaUplink::service(uint32_t nowMs)
+{
+    if (!_hasPending || _radio.isBusy())
+        return false;
+
+    // Roll the daily budget window
+    if (nowMs - _dayStartMs >= DAY_MS)
+    {
+        _dayStartMs = nowMs;
+        _airtimeUsedTodayMs = 0;
+    }
+
+    // Signed difference so the comparison survives millis() wrap-around
+    if (_hasSent && (int32_t)(nowMs - _nextAllowedMs) < 0)
+        return false;
+
+    uint32_t airtime = loraAirtimeMs(_spreadingFactor, 125000, BIN_READING_PACKED_SIZE + LORAWAN_OVERHEAD_BYTES);
+    if (_airtimeUsedTodayMs + airtime > _dailyAirtimeBudgetMs)
+        return false;
+
+    uint8_t buffer[BIN_READING_PACKED_SIZE];
+    packBinReading(_pending, buffer);
+    if (!_radio.send(PORT, buffer, sizeof(buffer)))
+        return false;
+
+    _hasPending = false;
+    _hasSent = true;
+    _airtimeUsedTodayMs += airtime;
+    _nextAllowedMs = nowMs + (uint32_t)(airtime / _maxDutyCycle);
+    _sentCount++;
+    return true;
+}
+
+bool LoRaUplink::hasPending() const
+{
+    return _hasPending;
+}
+
+uint32_t LoRaUplink::getSentCount() const
+{
+    return _sentCount;
+}
+
+uint32_t LoRaUplink::getDroppedCount() const
+{
+    return _droppedCount;
+}
+
+uint32_t LoRaUplink::getAirtimeUsedTodayMs() const
+{
+    return _airtimeUsedTodayMs;
+}
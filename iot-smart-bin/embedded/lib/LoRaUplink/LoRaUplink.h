@@ -0,0 +1,104 @@
+#ifndef LORA_UPLINK_H
+#define LORA_UPLINK_H
+
+#include <stdint.h>
+
+/**
+ * A bin reading reduced to what fits in a LoRaWAN fallback uplink.
+ */
+struct BinReading
+{
+    uint8_t fillLevel;         // 0-100 %
+    uint8_t batteryPercentage; // 0-100 %
+    bool isTilted;
+};
+
+// Packed layout (2 bytes): [tilt:1 | fill:7] [reserved:1 | battery:7]
+const uint8_t BIN_READING_PACKED_SIZE = 2;
+
+// LoRaWAN MAC overhead added to every application payload (MHDR, DevAddr, FCtrl, FCnt, FPort, MIC)
+const uint8_t LORAWAN_OVERHEAD_BYTES = 13;
+
+void packBinReading(const BinReading &reading, uint8_t *buffer);
+bool unpackBinReading(const uint8_t *buffer, uint8_t length, BinReading &reading);
+
+/**
+ * Time on air of a LoRa frame (Semtech AN1200.13), explicit header, CRC on, coding rate 4/5, 8 preamble symbols.
+ * @param spreadingFactor 7-12
+ * @param bandwidthHz Usually 125000
+ * @param phyPayloadLength Application payload + LORAWAN_OVERHEAD_BYTES
+ * @returns Airtime in milliseconds (rounded up).
+ */
+uint32_t loraAirtimeMs(uint8_t spreadingFactor, uint32_t bandwidthHz, uint8_t phyPayloadLength);
+
+/**
+ * The radio the uplink talks to. Implemented over LMIC on the device, and by a simulated radio on Linux.
+ */
+class LoRaRadio
+{
+public:
+    virtual ~LoRaRadio() {}
+
+    /**
+     * Returns true while a transmission (or its RX windows) is still pending.
+     */
+    virtual bool isBusy() = 0;
+
+    /**
+     * Queues an unconfirmed uplink. Returns false if the radio refused it.
+     */
+    virtual bool send(uint8_t port, const uint8_t *data, uint8_t length) = 0;
+};
+
+/**
+ * Fallback uplink for bin readings. Holds only the latest reading (constant memory) and sends it
+ * when the radio is free, the duty cycle allows it and the daily airtime budget is not used up.
+ */
+class LoRaUplink
+{
+public:
+    static const uint8_t PORT = 2;
+    static const uint32_t DAY_MS = 24UL * 60 * 60 * 1000;
+
+    /**
+     * @param radio Radio backend.
+     * @param spreadingFactor Used to estimate airtime. Use the slowest SF the network may assign.
+     * @param maxDutyCycle Fraction of time on air allowed (0.01 = 1%).
+     * @param dailyAirtimeBudgetMs Airtime allowed per 24h (TTN fair use policy is 30s).
+     */
+    LoRaUplink(LoRaRadio &radio, uint8_t spreadingFactor = 10, float maxDutyCycle = 0.01, uint32_t dailyAirtimeBudgetMs = 30000);
+
+    /**
+     * Stores a reading to send. A reading that was still pending is replaced (and counted as dropped).
+     */
+    void queue(const BinReading &reading);
+
+    /**
+     * Sends the pending reading if allowed. Call regularly from the main loop.
+     * @returns True if an uplink was handed to the radio.
+     */
+    bool service(uint32_t nowMs);
+
+    bool hasPending() const;
+    uint32_t getSentCount() const;
+    uint32_t getDroppedCount() const;
+    uint32_t getAirtimeUsedTodayMs() const;
+
+private:
+    LoRaRadio &_radio;
+    uint8_t _spreadingFactor;
+    float _maxDutyCycle;
+    uint32_t _dailyAirtimeBudgetMs;
+
+    BinReading _pending;
+    bool _hasPending;
+
+    bool _hasSent;
+    uint32_t _nextAllowedMs;
+    uint32_t _dayStartMs;
+    uint32_t _airtimeUsedTodayMs;
+    uint32_t _sentCount;
+    uint32_t _droppedCount;
+};
+
+#endif
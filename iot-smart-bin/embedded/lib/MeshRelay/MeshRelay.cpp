@@ -0,0 +1,282 @@
+#include "MeshRelay.h"
+#include <string.h>
+
+bool isValidMeshId(const char *id)
+{
+    size_t length = strlen(id);
+    if (length == 0 || length > MESH_MAX_ID_LENGTH)
+        return false;
+    if (strcmp(id, "group") == 0 || strcmp(id, "all") == 0)
+        return false;
+
+    for (const char *c = id; *c != '\0'; c++)
+    {
+        bool isAllowed = (*c >= 'A' && *c <= 'Z') || (*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9') ||
+                         *c == '-' || *c == '_';
+        if (!isAllowed)
+            return false;
+    }
+    return true;
+}
+
+MeshRelay::MeshRelay(MeshLink &link, const char *deviceId, uint32_t beaconIntervalMs, uint32_t relayTimeoutMs,
+                     uint32_t retryIntervalMs, uint8_t maxRetries)
+    : _link(link), _beaconIntervalMs(beaconIntervalMs), _relayTimeoutMs(relayTimeoutMs),
+      _retryIntervalMs(retryIntervalMs), _maxRetries(maxRetries),
+      _allowedOrigins(nullptr), _allowedOriginCount(0), _hasUplink(false), _hasBeaconed(false), _lastBeaconMs(0), _queueHead(0), _queueCount(0), _nextOriginSlot(0),
+      _hasRelay(false), _lastRelayHeardMs(0), _hasPending(false), _isAwaitingAck(false), _seq(0), _attempts(0),
+      _lastSendMs(0), _sentCount(0), _droppedCount(0), _relayedCount(0)
+{
+    strncpy(_deviceId, deviceId, MESH_MAX_ID_LENGTH);
+    _deviceId[MESH_MAX_ID_LENGTH] = '\0';
+    memset(_originIds, 0, sizeof(_originIds));
+    memset(_originSeqs, 0, sizeof(_originSeqs));
+    memset(_originHeardMs, 0, sizeof(_originHeardMs));
+    memset(_relayMac, 0, sizeof(_relayMac));
+}
+
+void MeshRelay::setUplink(bool hasUplink)
+{
+    if (hasUplink && !_hasUplink)
+    {
+        // Announce right away
+        _hasBeaconed = false;
+    }
+    _hasUplink = hasUplink;
+}
+
+bool MeshRelay::hasUplink() const
+{
+    return _hasUplink;
+}
+
+void MeshRelay::setAllowedOrigins(const char *const *ids, uint8_t count)
+{
+    _allowedOrigins = ids;
+    _allowedOriginCount = count;
+}
+
+void MeshRelay::seedSeq(uint8_t seq)
+{
+    _seq = seq;
+}
+
+void MeshRelay::queue(const MeshReading &reading)
+{
+    if (_hasPending)
+    {
+        _droppedCount++;
+    }
+    _pending = reading;
+    _hasPending = true;
+    _isAwaitingAck = false;
+    _attempts = 0;
+    _seq++;
+}
+
+bool MeshRelay::hasPending() const
+{
+    return _hasPending;
+}
+
+bool MeshRelay::hasRelay(uint32_t nowMs) const
+{
+    return _hasRelay && nowMs - _lastRelayHeardMs < _relayTimeoutMs;
+}
+
+uint8_t MeshRelay::buildHeader(uint8_t *frame, MeshFrameType type, uint8_t seq, const char *id) const
+{
+    uint8_t idLength = strlen(id);
+    frame[0] = MESH_PROTOCOL_VERSION;
+    frame[1] = type;
+    frame[2] = seq;
+    frame[3] = idLength;
+    memcpy(frame + MESH_HEADER_SIZE, id, idLength);
+    return MESH_HEADER_SIZE + idLength;
+}
+
+void MeshRelay::onReceive(const uint8_t *mac, const uint8_t *data, uint8_t length, uint32_t nowMs)
+{
+    if (length < MESH_HEADER_SIZE || data[0] != MESH_PROTOCOL_VERSION)
+        return;
+
+    uint8_t type = data[1];
+    uint8_t seq = data[2];
+    uint8_t idLength = data[3];
+    if (idLength == 0 || idLength > MESH_MAX_ID_LENGTH || MESH_HEADER_SIZE + idLength > length)
+        return;
+
+    char id[MESH_MAX_ID_LENGTH + 1];
+    memcpy(id, data + MESH_HEADER_SIZE, idLength);
+    id[idLength] = '\0';
+    // The id ends up in MQTT topics, a wildcard or '/' in it would break or redirect the publish
+    if (strlen(id) != idLength || !isValidMeshId(id))
+        return;
+    const uint8_t *payload = data + MESH_HEADER_SIZE + idLength;
+    uint8_t payloadLength = length - MESH_HEADER_SIZE - idLength;
+
+    switch (type)
+    {
+    case MESH_BEACON:
+        // Stay with the current relay while it is alive, so retries don't hop between relays
+        if (!hasRelay(nowMs) || memcmp(_relayMac, mac, MESH_MAC_LENGTH) == 0)
+        {
+            memcpy(_relayMac, mac, MESH_MAC_LENGTH);
+            _hasRelay = true;
+            _lastRelayHeardMs = nowMs;
+        }
+        break;
+
+    case MESH_READING:
+        if (_hasUplink && isAllowedOrigin(id))
+        {
+            handleReading(mac, seq, id, payload, payloadLength, nowMs);
+        }
+        break;
+
+    case MESH_ACK:
+        if (_isAwaitingAck && seq == _seq && strcmp(id, _deviceId) == 0)
+        {
+            _hasPending = false;
+            _isAwaitingAck = false;
+            _lastRelayHeardMs = nowMs;
+            _sentCount++;
+        }
+        break;
+    }
+}
+
+int8_t MeshRelay::findOrigin(const char *originId) const
+{
+    for (uint8_t i = 0; i < MAX_ORIGINS; i++)
+    {
+        if (strcmp(_originIds[i], originId) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool MeshRelay::isAllowedOrigin(const char *originId) const
+{
+    // Never publish as ourselves on behalf of someone else
+    if (strcmp(originId, _deviceId) == 0)
+        return false;
+
+    for (uint8_t i = 0; i < _allowedOriginCount; i++)
+    {
+        if (strcmp(_allowedOrigins[i], originId) == 0)
+            return true;
+    }
+    return false;
+}
+
+void MeshRelay::handleReading(const uint8_t *mac, uint8_t seq, const char *originId, const uint8_t *payload, uint8_t payloadLength,
+                              uint32_t nowMs)
+{
+    MeshReading reading;
+    if (payloadLength < BIN_READING_PACKED_SIZE + 2 || !unpackBinReading(payload, BIN_READING_PACKED_SIZE, reading.reading))
+        return;
+    reading.voltageMv = payload[BIN_READING_PACKED_SIZE] | (payload[BIN_READING_PACKED_SIZE + 1] << 8);
+
+    // A lost ACK makes the origin resend the same reading: acknowledge again, but publish it once.
+    // Resends follow each other within the relay timeout. A matching seq heard later is a new reading
+    // from an origin that rebooted (its seq started over) or wrapped around.
+    int8_t slot = findOrigin(originId);
+    bool isRepeat = slot >= 0 && _originSeqs[slot] == seq && nowMs - _originHeardMs[slot] < _relayTimeoutMs;
+    if (isRepeat)
+    {
+        _originHeardMs[slot] = nowMs;
+    }
+    else
+    {
+        // No ACK when full, the origin keeps the reading and retries
+        if (_queueCount >= QUEUE_SIZE)
+            return;
+
+        if (slot < 0)
+        {
+            // New origin, overwrite the oldest slot
+            slot = _nextOriginSlot;
+            _nextOriginSlot = (_nextOriginSlot + 1) % MAX_ORIGINS;
+            strcpy(_originIds[slot], originId);
+        }
+        _originSeqs[slot] = seq;
+        _originHeardMs[slot] = nowMs;
+
+        RelayedReading &queued = _queue[(_queueHead + _queueCount) % QUEUE_SIZE];
+        strcpy(queued.originId, originId);
+        queued.data = reading;
+        _queueCount++;
+        _relayedCount++;
+    }
+
+    uint8_t frame[MESH_MAX_FRAME_SIZE];
+    uint8_t length = buildHeader(frame, MESH_ACK, seq, originId);
+    _link.send(mac, frame, length);
+}
+
+void MeshRelay::service(uint32_t nowMs)
+{
+    if (_hasUplink && (!_hasBeaconed || nowMs - _lastBeaconMs >= _beaconIntervalMs))
+    {
+        uint8_t frame[MESH_MAX_FRAME_SIZE];
+        uint8_t length = buildHeader(frame, MESH_BEACON, 0, _deviceId);
+        _link.send(nullptr, frame, length);
+        _hasBeaconed = true;
+        _lastBeaconMs = nowMs;
+    }
+
+    // With an uplink of our own, readings are published directly
+    if (_hasUplink || !_hasPending || !hasRelay(nowMs))
+        return;
+
+    if (_isAwaitingAck && nowMs - _lastSendMs < _retryIntervalMs)
+        return;
+
+    if (_attempts >= _maxRetries)
+    {
+        // The relay stopped answering, wait for a beacon (possibly from another relay)
+        _hasRelay = false;
+        _isAwaitingAck = false;
+        _attempts = 0;
+        return;
+    }
+
+    uint8_t frame[MESH_MAX_FRAME_SIZE];
+    uint8_t length = buildHeader(frame, MESH_READING, _seq, _deviceId);
+    packBinReading(_pending.reading, frame + length);
+    length += BIN_READING_PACKED_SIZE;
+    frame[length++] = _pending.voltageMv & 0xFF;
+    frame[length++] = _pending.voltageMv >> 8;
+
+    _link.send(_relayMac, frame, length);
+    _isAwaitingAck = true;
+    _attempts++;
+    _lastSendMs = nowMs;
+}
+
+bool MeshRelay::popRelayed(RelayedReading &reading)
+{
+    if (_queueCount == 0)
+        return false;
+
+    reading = _queue[_queueHead];
+    _queueHead = (_queueHead + 1) % QUEUE_SIZE;
+    _queueCount--;
+    return true;
+}
+
+uint32_t MeshRelay::getSentCount() const
+{
+    return _sentCount;
+}
+
+uint32_t MeshRelay::getDroppedCount() const
+{
+    return _droppedCount;
+}
+
+uint32_t MeshRelay::getRelayedCount() const
+{
+    return _relayedCount;
+}
@@ -0,0 +1,175 @@
+#ifndef MESH_RELAY_H
+#define MESH_RELAY_H
+
+#include <stdint.h>
+#include "LoRaUplink.h" // BinReading and its packed layout
+
+const uint8_t MESH_MAC_LENGTH = 6;
+const uint8_t MESH_MAX_ID_LENGTH = 15;
+const uint8_t MESH_PROTOCOL_VERSION = 1;
+
+// Frame layout: [version] [type] [seq] [idLength] [id...] [payload...]
+// BEACON:  id = relay,  no payload. Broadcast by bins that have an uplink.
+// READING: id = origin, payload = packed BinReading (2 bytes) + voltage in mV (2 bytes, little endian).
+// ACK:     id = origin, seq of the acknowledged reading, no payload.
+enum MeshFrameType
+{
+    MESH_BEACON = 1,
+    MESH_READING = 2,
+    MESH_ACK = 3
+};
+
+/**
+ * Returns true if the id can be used as a bin id in MQTT topics: 1 to MESH_MAX_ID_LENGTH letters, digits, '-' or '_'.
+ * This rules out the wildcards '+' and '#', '/' (extra topic levels) and the reserved "group" and "all".
+ */
+bool isValidMeshId(const char *id);
+
+const uint8_t MESH_HEADER_SIZE = 4;
+const uint8_t MESH_MAX_FRAME_SIZE = MESH_HEADER_SIZE + MESH_MAX_ID_LENGTH + BIN_READING_PACKED_SIZE + 2;
+
+/**
+ * A reading as it travels over the mesh.
+ */
+struct MeshReading
+{
+    BinReading reading;
+    uint16_t voltageMv;
+};
+
+/**
+ * A reading received from another bin, waiting to be published under the origin's topics.
+ */
+struct RelayedReading
+{
+    char originId[MESH_MAX_ID_LENGTH + 1];
+    MeshReading data;
+};
+
+/**
+ * The link layer the relay talks to. Implemented over ESP-NOW on the device, and by a simulated link on Linux.
+ */
+class MeshLink
+{
+public:
+    virtual ~MeshLink() {}
+
+    /**
+     * Sends a frame to one peer, or to every peer in range if mac is nullptr.
+     * Returns false if the link refused it.
+     */
+    virtual bool send(const uint8_t *mac, const uint8_t *data, uint8_t length) = 0;
+};
+
+/**
+ * Single-hop relay between bins. Every node runs both roles:
+ *  - With an uplink (WiFi + MQTT) it beacons, and acknowledges and queues readings from other bins.
+ *  - Without one it sends its own latest reading to the relay it last heard, retrying until acknowledged.
+ */
+class MeshRelay
+{
+public:
+    static const uint8_t QUEUE_SIZE = 8;
+    static const uint8_t MAX_ORIGINS = 8;
+
+    /**
+     * @param beaconIntervalMs How often a node with an uplink announces itself.
+     * @param relayTimeoutMs A relay not heard for this long is forgotten.
+     * @param retryIntervalMs Time to wait for an ACK before sending again.
+     * @param maxRetries Unacknowledged sends before the relay is forgotten.
+     */
+    MeshRelay(MeshLink &link, const char *deviceId, uint32_t beaconIntervalMs = 5000, uint32_t relayTimeoutMs = 30000,
+              uint32_t retryIntervalMs = 500, uint8_t maxRetries = 3);
+
+    /**
+     * Switches the relay role on or off. Call whenever the uplink state may have changed.
+     */
+    void setUplink(bool hasUplink);
+    bool hasUplink() const;
+
+    /**
+     * Sets the bins this node relays for. Readings from any other id are neither acknowledged nor published,
+     * since the relay publishes them as that bin. Nothing is relayed until this is called.
+     * @param ids Must stay valid for the lifetime of the relay.
+     */
+    void setAllowedOrigins(const char *const *ids, uint8_t count);
+
+    /**
+     * Sets the sequence number the next readings count up from. Seed it randomly on every boot:
+     * a relay takes a reading with the same seq as the origin's last one for a resend, and a
+     * rebooted origin would otherwise start over at the same seq.
+     */
+    void seedSeq(uint8_t seq);
+
+    /**
+     * Stores this bin's reading to send through a relay. A reading still pending is replaced (and counted as dropped).
+     */
+    void queue(const MeshReading &reading);
+    bool hasPending() const;
+    bool hasRelay(uint32_t nowMs) const;
+
+    /**
+     * Handles a frame from the link. On the device, frames arrive in the WiFi task and must be
+     * handed over to the main loop before calling this.
+     */
+    void onReceive(const uint8_t *mac, const uint8_t *data, uint8_t length, uint32_t nowMs);
+
+    /**
+     * Sends beacons and pending readings. Call regularly from the main loop.
+     */
+    void service(uint32_t nowMs);
+
+    /**
+     * Takes the oldest reading received for another bin. Returns false if there is none.
+     */
+    bool popRelayed(RelayedReading &reading);
+
+    uint32_t getSentCount() const;
+    uint32_t getDroppedCount() const;
+    uint32_t getRelayedCount() const;
+
+private:
+    uint8_t buildHeader(uint8_t *frame, MeshFrameType type, uint8_t seq, const char *id) const;
+    void handleReading(const uint8_t *mac, uint8_t seq, const char *originId, const uint8_t *payload, uint8_t payloadLength,
+                       uint32_t nowMs);
+    int8_t findOrigin(const char *originId) const;
+    bool isAllowedOrigin(const char *originId) const;
+
+    MeshLink &_link;
+    char _deviceId[MESH_MAX_ID_LENGTH + 1];
+    uint32_t _beaconIntervalMs;
+    uint32_t _relayTimeoutMs;
+    uint32_t _retryIntervalMs;
+    uint8_t _maxRetries;
+
+    // Relay role
+    const char *const *_allowedOrigins;
+    uint8_t _allowedOriginCount;
+    bool _hasUplink;
+    bool _hasBeaconed;
+    uint32_t _lastBeaconMs;
+    RelayedReading _queue[QUEUE_SIZE];
+    uint8_t _queueHead;
+    uint8_t _queueCount;
+    char _originIds[MAX_ORIGINS][MESH_MAX_ID_LENGTH + 1];
+    uint8_t _originSeqs[MAX_ORIGINS];
+    uint32_t _originHeardMs[MAX_ORIGINS];
+    uint8_t _nextOriginSlot;
+
+    // Origin role
+    bool _hasRelay;
+    uint8_t _relayMac[MESH_MAC_LENGTH];
+    uint32_t _lastRelayHeardMs;
+    MeshReading _pending;
+    bool _hasPending;
+    bool _isAwaitingAck;
+    uint8_t _seq;
+    uint8_t _attempts;
+    uint32_t _lastSendMs;
+
+    uint32_t _sentCount;
+    uint32_t _droppedCount;
+    uint32_t _relayedCount;
+};
+
+#endif
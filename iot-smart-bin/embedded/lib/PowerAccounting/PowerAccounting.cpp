@@ -0,0 +1,145 @@
+#include "PowerAccounting.h"
+
+const char *const POWER_STATE_NAMES[POWER_STATE_COUNT] = {
+    "modemSleep",
+    "lightSleep",
+    "deepSleep",
+    "radio",
+    "tls",
+    "sampling",
+    "servo",
+};
+
+static bool isChipState(PowerState state)
+{
+    return state <= POWER_DEEP_SLEEP;
+}
+
+PowerAccounting::PowerAccounting(PowerLedger &ledger, const float *currentMa)
+    : _ledger(ledger), _currentMa(currentMa), _lastUpdateUs(0), _unbookedLightUs(0)
+{
+    for (uint8_t i = 0; i < POWER_STATE_COUNT; i++)
+    {
+        _loadStartUs[i] = 0;
+        _isActive[i] = false;
+    }
+}
+
+void PowerAccounting::begin(uint64_t nowUs)
+{
+    _lastUpdateUs = nowUs;
+    _unbookedLightUs = 0;
+    for (uint8_t i = 0; i < POWER_STATE_COUNT; i++)
+        _isActive[i] = false;
+}
+
+void PowerAccounting::set(PowerState state, bool isActive, uint64_t nowUs)
+{
+    if (isChipState(state) || _isActive[state] == isActive)
+        return;
+
+    if (isActive)
+    {
+        _loadStartUs[state] = nowUs;
+    }
+    else
+    {
+        _ledger.timeUs[state] += nowUs - _loadStartUs[state];
+    }
+    _isActive[state] = isActive;
+}
+
+bool PowerAccounting::isActive(PowerState state) const
+{
+    return _isActive[state];
+}
+
+void PowerAccounting::add(PowerState state, uint64_t durationUs)
+{
+    _ledger.timeUs[state] += durationUs;
+    if (state == POWER_LIGHT_SLEEP)
+    {
+        // Light sleep happens within this boot's elapsed time, update() books only the rest as awake
+        _unbookedLightUs += durationUs;
+    }
+}
+
+void PowerAccounting::update(uint64_t nowUs)
+{
+    if (nowUs <= _lastUpdateUs)
+        return;
+
+    uint64_t elapsedUs = nowUs - _lastUpdateUs;
+    uint64_t lightUs = _unbookedLightUs < elapsedUs ? _unbookedLightUs : elapsedUs;
+    _ledger.timeUs[POWER_MODEM_SLEEP] += elapsedUs - lightUs;
+    _unbookedLightUs -= lightUs;
+    _lastUpdateUs = nowUs;
+
+    for (uint8_t i = 0; i < POWER_STATE_COUNT; i++)
+    {
+        if (_isActive[i])
+        {
+            _ledger.timeUs[i] += nowUs - _loadStartUs[i];
+            _loadStartUs[i] = nowUs;
+        }
+    }
+}
+
+void PowerAccounting::markSleepStart(uint64_t wallUs)
+{
+    _ledger.sleepStartUs = wallUs;
+}
+
+void PowerAccounting::markWake(uint64_t wallUs)
+{
+    if (_ledger.sleepStartUs != 0 && wallUs > _ledger.sleepStartUs)
+    {
+        add(POWER_DEEP_SLEEP, wallUs - _ledger.sleepStartUs);
+    }
+    _ledger.sleepStartUs = 0;
+    _unbookedLightUs = 0;
+}
+
+uint64_t PowerAccounting::getTimeUs(PowerState state) const
+{
+    return _ledger.timeUs[state];
+}
+
+uint64_t PowerAccounting::getTotalUs() const
+{
+    return _ledger.timeUs[POWER_MODEM_SLEEP] + _ledger.timeUs[POWER_LIGHT_SLEEP] + _ledger.timeUs[POWER_DEEP_SLEEP];
+}
+
+float PowerAccounting::getAverageCurrentMa() const
+{
+    uint64_t totalUs = getTotalUs();
+    if (totalUs == 0)
+        return 0;
+
+    // Sum in mA*s, so a few days of microseconds don't lose the small states in float precision
+    double chargeMas = 0;
+    for (uint8_t i = 0; i < POWER_STATE_COUNT; i++)
+    {
+        chargeMas += _currentMa[i] * (_ledger.timeUs[i] / 1e6);
+    }
+    return (float)(chargeMas / (totalUs / 1e6));
+}
+
+float PowerAccounting::getProjectedLifeHours(float remainingMah) const
+{
+    float averageMa = getAverageCurrentMa();
+    if (averageMa <= 0)
+        return 0;
+    return remainingMah / averageMa;
+}
+
+void PowerAccounting::reset()
+{
+    for (uint8_t i = 0; i < POWER_STATE_COUNT; i++)
+    {
+        _ledger.timeUs[i] = 0;
+        _loadStartUs[i] = _lastUpdateUs;
+    }
+    _ledger.sleepStartUs = 0;
+    _unbookedLightUs = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef POWER_ACCOUNTING_H
+#define POWER_ACCOUNTING_H
+
+#include <stdint.h>
+
+/**
+ * The chip is always in exactly one of the first three states (awake with the modem sleeping between
+ * beacons, light sleep or deep sleep). The others are loads that add on top of it and may overlap.
+ */
+enum PowerState
+{
+    POWER_MODEM_SLEEP,
+    POWER_LIGHT_SLEEP,
+    POWER_DEEP_SLEEP,
+    POWER_RADIO_CONNECTED,
+    POWER_TLS_HANDSHAKE,
+    POWER_SAMPLING,
+    POWER_SERVO,
+    POWER_STATE_COUNT
+};
+
+extern const char *const POWER_STATE_NAMES[POWER_STATE_COUNT];
+
+/**
+ * Accumulated time per state. Plain data, so it can be kept in RTC memory across deep sleep.
+ */
+struct PowerLedger
+{
+    uint64_t timeUs[POWER_STATE_COUNT];
+    uint64_t sleepStartUs; // Wall-clock time when deep sleep was entered, 0 if not sleeping
+};
+
+/**
+ * Time-per-state accounting and the average current / battery life it projects
+ * from a per-state current table.
+ */
+class PowerAccounting
+{
+public:
+    /**
+     * @param ledger Where the totals are kept (survives deep sleep if the ledger does).
+     * @param currentMa Current per state in mA. Chip states are absolute, loads are added on top.
+     */
+    PowerAccounting(PowerLedger &ledger, const float *currentMa);
+
+    /**
+     * Starts timing this boot. Open loads from before are discarded.
+     * @param nowUs Monotonic time since boot (esp_timer_get_time()).
+     */
+    void begin(uint64_t nowUs);
+
+    /**
+     * Starts or stops a load. Calls that don't change the state are ignored.
+     */
+    void set(PowerState state, bool isActive, uint64_t nowUs);
+    bool isActive(PowerState state) const;
+
+    /**
+     * Moves time that was measured elsewhere out of POWER_MODEM_SLEEP (light sleep), or adds time
+     * that passed outside of this boot (deep sleep).
+     */
+    void add(PowerState state, uint64_t durationUs);
+
+    /**
+     * Books all time up to now, including loads that are still active.
+     */
+    void update(uint64_t nowUs);
+
+    /**
+     * Deep sleep bookkeeping. Both take wall-clock time, which keeps running across deep sleep.
+     */
+    void markSleepStart(uint64_t wallUs);
+    void markWake(uint64_t wallUs);
+
+    uint64_t getTimeUs(PowerState state) const;
+
+    /**
+     * Total accounted time (the chip states).
+     */
+    uint64_t getTotalUs() const;
+
+    float getAverageCurrentMa() const;
+
+    /**
+     * Hours until the given charge is used up at the average current, or 0 if nothing has been accounted yet.
+     */
+    float getProjectedLifeHours(float remainingMah) const;
+
+    void reset();
+
+private:
+    PowerLedger &_ledger;
+    const float *_currentMa;
+    uint64_t _lastUpdateUs;
+    uint64_t _unbookedLightUs;
+    uint64_t _loadStartUs[POWER_STATE_COUNT];
+    bool _isActive[POWER_STATE_COUNT];
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "ReadingAggregator.h"
+
+static const float MS_PER_HOUR = 3600000.0f;
+
+ReadingAggregator::ReadingAggregator()
+{
+    reset();
+}
+
+void ReadingAggregator::reset()
+{
+    _count = 0;
+    _firstTimeMs = 0;
+    _fillMin = 0;
+    _fillMax = 0;
+    _fillSum = 0;
+    _fillLast = 0;
+    _sumT = 0;
+    _sumTT = 0;
+    _sumB = 0;
+    _sumTB = 0;
+    _batteryLast = 0;
+}
+
+void ReadingAggregator::add(uint32_t timeMs, float fillLevel, float batteryPercentage)
+{
+    if (_count == 0)
+    {
+        _firstTimeMs = timeMs;
+        _fillMin = fillLevel;
+        _fillMax = fillLevel;
+    }
+    else
+    {
+        if (fillLevel < _fillMin)
+            _fillMin = fillLevel;
+        if (fillLevel > _fillMax)
+            _fillMax = fillLevel;
+    }
+    _fillLast = fillLevel;
+
+    // Stop counting (not overflow) if a period is left running far too long
+    if (_count == UINT16_MAX)
+        return;
+
+    _count++;
+    _fillSum += fillLevel;
+
+    float t = (timeMs - _firstTimeMs) / MS_PER_HOUR;
+    _sumT += t;
+    _sumTT += t * t;
+    _sumB += batteryPercentage;
+    _sumTB += t * batteryPercentage;
+    _batteryLast = batteryPercentage;
+}
+
+bool ReadingAggregator::isEmpty() const
+{
+    return _count == 0;
+}
+
+uint16_t ReadingAggregator::getCount() const
+{
+    return _count;
+}
+
+float ReadingAggregator::getFillMin() const
+{
+    return _fillMin;
+}
+
+float ReadingAggregator::getFillMax() const
+{
+    return _fillMax;
+}
+
+float ReadingAggregator::getFillMean() const
+{
+    return _count > 0 ? _fillSum / _count : 0;
+}
+
+float ReadingAggregator::getFillLast() const
+{
+    return _fillLast;
+}
+
+float ReadingAggregator::getBatteryLast() const
+{
+    return _batteryLast;
+}
+
+float ReadingAggregator::getBatteryTrendPerHour() const
+{
+    if (_count < 2)
+        return 0;
+
+    float denominator = _count * _sumTT - _sumT * _sumT;
+    if (denominator <= 0)
+        return 0;
+
+    return (_count * _sumTB - _sumT * _sumB) / denominator;
+}
@@ -0,0 +1,63 @@
+#ifndef READING_AGGREGATOR_H
+#define READING_AGGREGATOR_H
+
+#include <stdint.h>
+
+/**
+ * Constant-memory statistics over a summary period: min/max/mean/last fill level,
+ * and the battery trend as a least-squares slope in percent per hour.
+ */
+class ReadingAggregator
+{
+public:
+    ReadingAggregator();
+
+    /**
+     * Adds one reading to the current period.
+     * @param timeMs Monotonic timestamp of the reading (millis()).
+     */
+    void add(uint32_t timeMs, float fillLevel, float batteryPercentage);
+
+    /**
+     * Starts a new period.
+     */
+    void reset();
+
+    bool isEmpty() const;
+    uint16_t getCount() const;
+
+    float getFillMin() const;
+    float getFillMax() const;
+    float getFillMean() const;
+
+    /**
+     * Fill level of the most recent reading, the bin's current state at the end of the period.
+     */
+    float getFillLast() const;
+
+    float getBatteryLast() const;
+
+    /**
+     * Battery slope over the period in percent per hour (negative when discharging).
+     * Returns 0 with fewer than two readings or if they all share a timestamp.
+     */
+    float getBatteryTrendPerHour() const;
+
+private:
+    uint16_t _count;
+    uint32_t _firstTimeMs;
+
+    float _fillMin;
+    float _fillMax;
+    float _fillSum;
+    float _fillLast;
+
+    // Running sums for the least-squares fit of battery against time (hours since first reading)
+    float _sumT;
+    float _sumTT;
+    float _sumB;
+    float _sumTB;
+    float _batteryLast;
+};
+
+#endif
@@ -0,0 +1,24 @@
+function decodeUplink(input) {
+  var data = {};
+
+  if (input.fPort !== 2 || input.bytes.length < 2) {
+    return {
+      data: data,
+      warnings: [],
+      errors: ["Unknown port or payload too short"],
+    };
+  }
+
+  // Byte 0: [tilt:1 | fill:7]
+  data.isTilted = (input.bytes[0] & 0x80) !== 0;
+  data.fillLevel = input.bytes[0] & 0x7f;
+
+  // Byte 1: [reserved:1 | battery:7]
+  data.batteryPercentage = input.bytes[1] & 0x7f;
+
+  return {
+    data: data,
+    warnings: [],
+    errors: [],
+  };
+}
@@ -1,13 +1,32 @@
 #include <Arduino.h>
 #include <WiFi.h>
+#include <Preferences.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <driver/rtc_io.h>
 #include <ArduinoJson.h>
 #include <ESP32Servo.h>
 #include <HCSR04.h>
 #include <TiltSensor.h>
+#include <HampelFilter.h>
+#include <LoRaUplink.h>
+#include <ReadingAggregator.h>
+#include <BinGeometry.h>
+#include <PowerAccounting.h>
+#include <sys/time.h>
+#include <esp_sntp.h>
 #include "api_config.h"
-#if defined(PRODUCTION_BUILD)
+
+// --- Transport Selection ---
+// development: MQTT over TCP (1883), production: MQTT over WSS (443), production-tls: MQTT over TLS (8883)
+#if defined(PRODUCTION_BUILD) && defined(MQTT_NATIVE_TLS)
+#define TRANSPORT_TLS
+#include <WiFiClientSecure.h> // For native MQTT over TLS
+#elif defined(PRODUCTION_BUILD)
+#define TRANSPORT_WSS
 #include <WebSocketsClient.h> // For WSS
 #else
+#define TRANSPORT_TCP
 #include <WiFiClient.h> // For standard MQTT
 #endif
 #include <MQTTPubSubClient.h>
@@ -19,6 +38,8 @@
 #define BIN_HEIGHT 100
 #define BATTERY_VOLTAGE_CALIBRATION 0.0
 #define CYCLE_INTERVAL_MS 10000
+#define SUMMARY_PERIOD_MS 3600000
+#define METRICS_PERIOD_MS 3600000
 
 #define MQTT_BROKER_URL "ci.dummy.prod"
 #define MQTT_BROKER_PORT 443
@@ -32,6 +53,40 @@
 #endif
 #endif
 
+#if defined(LORAWAN_FALLBACK_ENABLED)
+#include <lmic.h>
+#include <hal/hal.h>
+#include <SPI.h>
+#endif
+
+#if defined(MESH_RELAY_ENABLED)
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <MeshRelay.h>
+#ifndef MESH_CHANNEL
+#define MESH_CHANNEL 1 // Only used if the AP can't be seen at all, otherwise its channel is used
+#endif
+#endif
+
+#ifndef SUMMARY_PERIOD_MS
+#define SUMMARY_PERIOD_MS 3600000 // 1 hour
+#endif
+#ifndef METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS 3600000 // 1 hour
+#endif
+#ifndef BATTERY_CAPACITY_MAH
+#define BATTERY_CAPACITY_MAH 2500 // Samsung INR18650-25R
+#endif
+#ifndef MQTT_BROKER_TLS_PORT
+#define MQTT_BROKER_TLS_PORT 8883
+#endif
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+#if defined(TRANSPORT_TLS) && !defined(MQTT_BROKER_CA_CERT)
+#error "The native TLS transport requires MQTT_BROKER_CA_CERT (PEM) to pin the broker certificate"
+#endif
+
 // --- WiFi Credentials ---
 const char *SSID = WIFI_SSID;
 const char *PASSWORD = WIFI_PASSWORD;
@@ -42,7 +97,7 @@ String clientId;
 // --- Sensor Setup ---
 const byte ECHO_PIN = 16;          // White Wire
 const byte TRIGGER_PIN = 17;       // Yellow Wire
-const u16_t MAX_DISTANCE_CM = 400; // Maximum distance to measure (in cm)
+const u16_t MAX_DISTANCE_CM = 400; // Full sensor range, only used while calibrating. Normal pings use the bin's range.
 UltraSonicDistanceSensor distanceSensor = UltraSonicDistanceSensor(TRIGGER_PIN, ECHO_PIN, MAX_DISTANCE_CM);
 
 const byte TILT_PIN = 13; // White Wire
@@ -66,30 +121,220 @@ const u16_t SERVO_BIN_OPEN_POS = 90;  // Degrees
 Servo servo;
 
 // --- Bin Configuration ---
-int threshold = 85;                     // Default value, overwritten by MQTT
+const int DEFAULT_THRESHOLD = 85;
+int threshold = DEFAULT_THRESHOLD;      // Effective threshold, resolved from the config sources below
 const float BIN_HEIGHT_CM = BIN_HEIGHT; // The total depth of the bin
 const float MIN_VALID_CM = 2.0;         // Sensor blind spot
 int lastValidFillLevel = 0;
+bool isBinClosed = false;
+
+// --- Bin Geometry ---
+// The empty-bin distance is measured at install time (cmd/calibrate/{id}) and persisted in NVS.
+// It bounds the echo timeout: for a 1m bin a miss costs ~8ms instead of ~29ms at the full 4m range.
+// An optional distance -> volume table corrects the fill level for tapered bins.
+BinGeometry binGeometry(BIN_HEIGHT_CM);
+bool isCalibrationPending = false;
+bool isCalibrating = false;
+String calibrationRequestId;
+
+// --- On-Device Aggregation ---
+// Routine readings are folded into a summary published every SUMMARY_PERIOD_MS on bins/{id}/summary.
+// Threshold crossings, tilts, remote requests and the first reading after boot/recovery still go out immediately.
+const bool USE_AGGREGATION = true;
+const unsigned long SUMMARY_PERIOD = SUMMARY_PERIOD_MS;
+ReadingAggregator aggregator;
+unsigned long lastSummaryTime = 0;
+bool isImmediatePublishPending = true; // The dashboard needs a first reading after boot
+
+// --- Config Precedence ---
+// A threshold can be set for the whole fleet, for the bin's group, or for the bin itself.
+// The most specific one that is set wins: device > group > all > DEFAULT_THRESHOLD.
+enum ConfigSource
+{
+  CONFIG_ALL,
+  CONFIG_GROUP,
+  CONFIG_DEVICE,
+  CONFIG_SOURCE_COUNT
+};
+const char *CONFIG_SOURCE_NAMES[CONFIG_SOURCE_COUNT] = {"all", "group", "device"};
+const int THRESHOLD_UNSET = -1;
+int thresholdBySource[CONFIG_SOURCE_COUNT] = {THRESHOLD_UNSET, THRESHOLD_UNSET, THRESHOLD_UNSET};
+
+// Group membership, assigned remotely and persisted in NVS
+const unsigned int MAX_GROUP_NAME_LENGTH = 32;
+String binGroup = ""; // Empty when the bin is not in a group
+Preferences preferences;
+
+// --- Cross-Cycle Outlier Rejection ---
+// Compares each burst result against the last few cycles to catch one-cycle spikes (e.g. a crooked bag)
+const uint8_t HAMPEL_WINDOW = 5;           // Number of past cycles considered
+const float HAMPEL_N_SIGMAS = 3.0;         // Rejection bound in scaled MADs
+const float HAMPEL_MIN_DEVIATION_CM = 3.0; // Never reject changes smaller than this
+HampelFilter cycleFilter(HAMPEL_WINDOW, HAMPEL_N_SIGMAS, HAMPEL_MIN_DEVIATION_CM);
 
 // --- Battery Configuration ---
 const int BATTERY_PIN = 35;
 const float VOLTAGE_CALIBRATION = BATTERY_VOLTAGE_CALIBRATION;
 // --- Timing & State Machine Variables ---
-unsigned long lastCycleTime = 0;
 const long CYCLE_INTERVAL = CYCLE_INTERVAL_MS;
 
+// Time-Slotted Scheduling
+// Each bin samples at its own offset within the cycle (hash of BIN_ID), so a fleet that boots together
+// after a power blip does not publish in lockstep. The slot grid is anchored at boot: remote triggers,
+// tilt recovery and reconnects never shift it, a power profile change only rescales it to the new cycle.
+unsigned long slotAnchorMs = 0;
+unsigned long slotOffsetMs = 0;
+unsigned long nextSlotTime = 0;
+bool isRecoveryPending = false;
+unsigned long recoverySampleTime = 0;
+
 // Sampling State Machine
+// Pings are scheduled by an esp_timer instead of polling millis(), so the loop can block (and the chip sleep) in between
 bool isSampling = false;
-unsigned long lastSampleTime = 0; // Tracks the 60ms gap
-const long SAMPLE_INTERVAL = 60;  // Time between individual pings
+const long SAMPLE_INTERVAL = 60; // Time between individual pings
 const int TARGET_SAMPLES = 11;
 std::vector<float> currentReadings;
+esp_timer_handle_t pingTimer = nullptr;
+TaskHandle_t loopTaskHandle = nullptr;
+volatile bool isPingDue = false;
+int burstPingCount = 0;
+
+// --- Power Management ---
+// The CPU runs at 80 MHz and light-sleeps automatically whenever all tasks are blocked.
+// 240 MHz is only requested while connecting to the broker, which is where the TLS handshake happens.
+// Light sleep needs an arduino-esp32 build with CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE,
+// without them the frequency is switched by hand and the chip only modem-sleeps between pings.
+#if defined(MESH_RELAY_ENABLED)
+// A relay must hear ESP-NOW frames from origins at any time, and an origin the relay's ACKs. With modem sleep or
+// light sleep the radio is off between DTIM beacons and most frames are missed, so mesh builds keep it receiving.
+// That is ~100 mA (ESP32 datasheet, RX) instead of ~25 mA while awake, and no light sleep between pings.
+const bool USE_LIGHT_SLEEP = false;
+const bool USE_MODEM_SLEEP = false;
+#else
+const bool USE_LIGHT_SLEEP = true;
+const bool USE_MODEM_SLEEP = true;
+#endif
+const uint32_t CPU_FREQ_SAMPLING_MHZ = 80;
+const uint32_t CPU_FREQ_TLS_MHZ = 240;
+const TickType_t LOOP_IDLE_TICKS = pdMS_TO_TICKS(10);
+const unsigned long SERVO_SETTLE_MS = 500; // The servo PWM stops in light sleep, stay awake until it has moved
+bool isPmEnabled = false;
+bool isLightSleepEnabled = false;
+esp_pm_lock_handle_t cpuMaxLock = nullptr;
+esp_pm_lock_handle_t noLightSleepLock = nullptr;
+bool isCpuMaxHeld = false;
+bool isNoLightSleepHeld = false;
+unsigned long awakeUntilTime = 0;
+
+int64_t burstStartUs = 0;
+int64_t burstIdleUs = 0;
+int64_t burstPingUs = 0;
+
+// --- Power-State Accounting ---
+// Time per power state is accumulated in RTC memory (survives deep sleep, cleared on power-on).
+// Weighted with the current table below it gives the average current and the projected battery life,
+// published on bins/{id}/metrics. The table can be recalibrated through config ("currentTable").
+const float DEFAULT_POWER_STATE_CURRENT_MA[POWER_STATE_COUNT] = {
+    25.0,  // Modem sleep: CPU on at 80 MHz, radio off between beacons (ESP32 datasheet: 20-31 mA)
+    0.8,   // Light sleep (ESP32 datasheet)
+    0.01,  // Deep sleep, RTC timer running (ESP32 datasheet). The board's regulator adds to this
+#if defined(MESH_RELAY_ENABLED)
+    75.0,  // Radio on: receiving continuously (no modem sleep), ~100 mA RX in total (ESP32 datasheet)
+#else
+    5.0,   // Radio connected: beacon wake-ups on top of modem sleep
+#endif
+    80.0,  // Broker connect / TLS handshake: 240 MHz and the radio receiving
+    15.0,  // Sampling: HC-SR04 working current
+    150.0, // Servo moving: HS-422 running current, no load
+};
+float powerStateCurrentMa[POWER_STATE_COUNT];
+RTC_DATA_ATTR PowerLedger powerLedger;
+PowerAccounting powerAccounting(powerLedger, powerStateCurrentMa);
+const unsigned long METRICS_PERIOD = METRICS_PERIOD_MS;
+unsigned long lastMetricsTime = 0;
+
+// --- Time Sync (SNTP) ---
+// Readings are stamped on the device at sample time. SNTP runs in the background once WiFi is up, nothing waits for it.
+// The system time keeps running across deep sleep on the RTC, so a wake only re-syncs once TIME_RESYNC_S has passed.
+// Every reading says how far its timestamp can be trusted:
+//  - "ntp":  synced since this boot/wake, the clock runs on the main crystal (ppm)
+//  - "rtc":  synced before a deep sleep, carried by the RTC slow clock (can drift by several percent of the sleep)
+//  - "none": no sync since power-on, no timestamp is sent and the server stamps the arrival time
+enum ClockQuality
+{
+  CLOCK_NONE,
+  CLOCK_RTC,
+  CLOCK_NTP
+};
+const char *CLOCK_QUALITY_NAMES[] = {"none", "rtc", "ntp"};
+const time_t TIME_RESYNC_S = 3600;
+RTC_DATA_ATTR time_t lastTimeSyncSec = 0; // Unix time of the last SNTP sync, 0 after power-on
+volatile bool isTimeSyncedThisBoot = false;
+bool isSntpStarted = false;
+
+// --- Battery Power Profiles ---
+// Selected from the battery percentage after every burst. A profile is entered when the battery drops below
+// its boundary, and left again only once the battery is PROFILE_HYSTERESIS_PERCENT above it.
+struct PowerProfile
+{
+  const char *name;
+  int enterBelowPercent;
+  uint8_t cycleMultiplier;   // x CYCLE_INTERVAL_MS
+  uint8_t summaryMultiplier; // x SUMMARY_PERIOD_MS, 0 = no summaries
+  bool isAlertOnly;          // Only threshold crossings and tilts are reported, deep sleep in between
+};
+
+enum PowerProfileId
+{
+  PROFILE_NORMAL,
+  PROFILE_SAVER,
+  PROFILE_CRITICAL,
+  PROFILE_COUNT
+};
+
+const PowerProfile POWER_PROFILES[PROFILE_COUNT] = {
+    {"normal", 101, 1, 1, false},
+    {"saver", 50, 3, 4, false},
+    {"critical", 20, 6, 0, true},
+};
+const int PROFILE_HYSTERESIS_PERCENT = 5;
+const unsigned long CRITICAL_HEARTBEAT_MS = 6UL * 60 * 60 * 1000; // A sleeping critical bin still checks in every 6h
+const int THRESHOLD_DEADZONE = 1;
+
+// Survive deep sleep, so the critical profile can sample without WiFi
+RTC_DATA_ATTR bool hasPowerProfile = false;
+RTC_DATA_ATTR uint8_t powerProfile = PROFILE_NORMAL;
+RTC_DATA_ATTR int sleepThreshold = DEFAULT_THRESHOLD;
+RTC_DATA_ATTR bool sleepIsBinClosed = false;
+RTC_DATA_ATTR uint32_t quietSleepMs = 0;
+
+// Remote Trigger Coalescing
+// Pings and config updates share bursts instead of forcing one each, and are rate limited
+const unsigned long MIN_TRIGGER_SPACING_MS = 2000;    // Minimum time between two remotely triggered bursts
+const unsigned long TRIGGER_BUDGET_WINDOW_MS = 60000; // Window over which the trigger budget applies
+const uint8_t TRIGGER_BUDGET = 6;                     // Max remotely triggered bursts per window
+const uint8_t MAX_REQUEST_IDS = 4;                    // Request ids echoed back per burst
+const uint8_t REQUEST_ID_LENGTH = 24;                 // Including null terminator
+bool remoteTriggerPending = false;
+unsigned long lastRemoteBurstTime = 0;
+unsigned long triggerWindowStart = 0;
+uint8_t triggerWindowCount = 0;
+char burstRequestIds[MAX_REQUEST_IDS][REQUEST_ID_LENGTH];
+unsigned long burstRequestReceivedMs[MAX_REQUEST_IDS]; // millis() when each request id arrived
+uint8_t burstRequestIdCount = 0;
+unsigned long burstSampleStartMs = 0; // millis() at the first/last ping of the last burst, for the latency stages
+unsigned long burstSampleEndMs = 0;
+uint8_t burstTriggerCount = 0; // Remote triggers served by the current/next burst (with or without id)
+bool isBurstJoined = false;    // A trigger joined a burst that was already sampling, i.e. started before it arrived
 
 // Tilt Recovery Logic
 bool wasTilted = false;
 
 // --- MQTT Client Setup ---
-#if defined(PRODUCTION_BUILD)
+#if defined(TRANSPORT_TLS)
+WiFiClientSecure client; // For native MQTT over TLS
+const char *ENV_SUFFIX = "-prod";
+#elif defined(TRANSPORT_WSS)
 WebSocketsClient client; // For WSS (Secure WebSocket)
 const char *ENV_SUFFIX = "-prod";
 #else
@@ -98,26 +343,481 @@ const char *ENV_SUFFIX = "-dev";
 #endif
 
 const char *BROKER_URL = MQTT_BROKER_URL;
+#if defined(TRANSPORT_TLS)
+const uint16_t BROKER_PORT = MQTT_BROKER_TLS_PORT;
+#else
 const uint16_t BROKER_PORT = MQTT_BROKER_PORT;
+#endif
 const char *MQTT_USER = MQTT_USERNAME;
 const char *MQTT_PASS = MQTT_PASSWORD;
 
 MQTTPubSubClient mqtt;
 
+// --- Persistent Session ---
+// With clean session off and a stable clientId, the broker keeps our subscriptions across reconnects,
+// and the server keeps bins/{id}/config retained, so a reconnect needs no SUBSCRIBE or get-config round trip.
+// Set to false to measure the old clean-session reconnect path.
+const bool USE_PERSISTENT_SESSION = true;
+const unsigned long CONFIG_WAIT_MS = 2000; // Wait this long for the retained config before sending get-config
+// Config topics are subscribed at QoS 1, so the broker queues config published while we are offline
+// and delivers it on resume. At QoS 0 a resumed session would miss it until the next fresh subscribe.
+const uint8_t CONFIG_QOS = 1;
+bool hasSubscribed = false;
+bool isConfigPending = false;
+bool isConfigRequested = false;
+unsigned long configRequestDeadline = 0;
+
+// --- LoRaWAN Fallback ---
+// When WiFi is unreachable, readings go out as a packed 2-byte LoRaWAN uplink instead of being lost
+const unsigned long WIFI_RETRY_INTERVAL_MS = 5 * 60 * 1000; // How often WiFi is retried while on a fallback
+unsigned long lastWifiAttemptTime = 0;
+bool isOnFallback = false;
+
+#if defined(LORAWAN_FALLBACK_ENABLED)
+// TTGO LoRa32 SX1276 wiring (same as lab3/part2)
+const lmic_pinmap lmic_pins = {
+    .nss = 18,
+    .rxtx = LMIC_UNUSED_PIN,
+    .rst = 23,
+    .dio = {/*dio0*/ 26, /*dio1*/ 33, /*dio2*/ 32},
+};
+
+// AppEUI, DevEUI in lsb format. AppKey in msb format.
+static const u1_t PROGMEM APPEUI[8] = APP_EUI;
+void os_getArtEui(u1_t *buf) { memcpy_P(buf, APPEUI, 8); }
+static const u1_t PROGMEM DEVEUI[8] = DEV_EUI;
+void os_getDevEui(u1_t *buf) { memcpy_P(buf, DEVEUI, 8); }
+static const u1_t PROGMEM APPKEY[16] = APP_KEY;
+void os_getDevKey(u1_t *buf) { memcpy_P(buf, APPKEY, 16); }
+
+class LmicRadio : public LoRaRadio
+{
+public:
+  bool isBusy() override
+  {
+    return LMIC.opmode & OP_TXRXPEND;
+  }
+
+  bool send(uint8_t port, const uint8_t *data, uint8_t length) override
+  {
+    // LMIC_setTxData2 takes a non-const buffer but copies it into its own frame
+    return LMIC_setTxData2(port, (xref2u1_t)data, length, 0) == LMIC_ERROR_SUCCESS;
+  }
+};
+
+LmicRadio lmicRadio;
+// SF10 is the slowest uplink data rate in US915, so airtime is never underestimated
+LoRaUplink loraUplink(lmicRadio, 10, 0.01, 30000);
+
+void onEvent(ev_t ev)
+{
+  switch (ev)
+  {
+  case EV_JOINING:
+    Serial.println("[LORA] Joining...");
+    break;
+  case EV_JOINED:
+    Serial.println("[LORA] Joined network.");
+    LMIC_setLinkCheckMode(0);
+    break;
+  case EV_JOIN_FAILED:
+    Serial.println("[LORA] Join failed.");
+    break;
+  case EV_TXCOMPLETE:
+    Serial.printf("[LORA] Uplink complete (Sent: %u, Dropped: %u, Airtime today: %u ms)\n",
+                  loraUplink.getSentCount(), loraUplink.getDroppedCount(), loraUplink.getAirtimeUsedTodayMs());
+    break;
+  default:
+    break;
+  }
+}
+#endif
+
+// --- ESP-NOW Relay Mesh ---
+// A bin without WiFi hands its reading to a neighbouring bin that has it (single hop), which publishes it
+// on bins/{origin}/data with "relayedBy". Every bin with a broker connection relays, no roles are configured.
+#if defined(MESH_RELAY_ENABLED)
+struct MeshFrame
+{
+  uint8_t mac[MESH_MAC_LENGTH];
+  uint8_t data[MESH_MAX_FRAME_SIZE];
+  uint8_t length;
+};
+QueueHandle_t meshRxQueue = nullptr;
+
+class EspNowLink : public MeshLink
+{
+public:
+  bool send(const uint8_t *mac, const uint8_t *data, uint8_t length) override
+  {
+    static const uint8_t BROADCAST[MESH_MAC_LENGTH] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    const uint8_t *peer = mac != nullptr ? mac : BROADCAST;
+    if (!esp_now_is_peer_exist(peer))
+    {
+      esp_now_peer_info_t info = {};
+      memcpy(info.peer_addr, peer, MESH_MAC_LENGTH);
+      info.channel = 0; // Whatever channel the radio is on
+      info.ifidx = WIFI_IF_STA;
+      if (esp_now_add_peer(&info) != ESP_OK)
+        return false;
+    }
+    return esp_now_send(peer, data, length) == ESP_OK;
+  }
+};
+
+EspNowLink espNowLink;
+MeshRelay meshRelay(espNowLink, BIN_ID);
+#if defined(MESH_ALLOWED_ORIGINS)
+// Frames are unauthenticated, so only these bins are published for (see credentials.h.example)
+const char *const MESH_ORIGINS[] = {MESH_ALLOWED_ORIGINS};
+#endif
+
+// Runs in the WiFi task, the frame is handled by serviceMesh() in the loop
+void onMeshReceive(const uint8_t *mac, const uint8_t *data, int length)
+{
+  if (length <= 0 || length > MESH_MAX_FRAME_SIZE)
+    return;
+
+  MeshFrame frame;
+  memcpy(frame.mac, mac, MESH_MAC_LENGTH);
+  memcpy(frame.data, data, length);
+  frame.length = length;
+  xQueueSend(meshRxQueue, &frame, 0);
+}
+#endif
+
+// --- Connection Timing ---
+// On the WSS transport every (re)connect is a full TLS handshake, so we time each one
+RTC_DATA_ATTR uint32_t brokerConnectCount = 0; // Survives deep sleep
+bool hasConnectedOnce = false;
+bool isTimingConnect = false;
+unsigned long connectStartTime = 0;
+unsigned long lastConnectDurationMs = 0;
+
 // --- Forward Declarations ---
 void triggerSampling();
+void requestSampling(const char *requestId);
+void handleConfig(ConfigSource source, const String &payload);
+void markConnectReady(const char *detail);
 void openBin();
+void closeBin();
+float readBatteryVoltage();
+int getBatteryPercentage(float voltage);
+void runQuietWake();
+uint32_t hashDeviceId(const char *id);
+#if defined(MESH_RELAY_ENABLED)
+void setupMesh();
+#endif
+
+/**
+ * Wall-clock time in microseconds. Unlike esp_timer it keeps running across deep sleep.
+ */
+uint64_t wallClockUs()
+{
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  return (uint64_t)now.tv_sec * 1000000ULL + now.tv_usec;
+}
+
+/**
+ * Runs in the lwIP task whenever SNTP sets the clock.
+ */
+void onTimeSync(struct timeval *tv)
+{
+  lastTimeSyncSec = tv->tv_sec;
+  isTimeSyncedThisBoot = true;
+}
+
+ClockQuality getClockQuality()
+{
+  if (isTimeSyncedThisBoot)
+    return CLOCK_NTP;
+  return lastTimeSyncSec != 0 ? CLOCK_RTC : CLOCK_NONE;
+}
+
+/**
+ * Starts SNTP in the background once WiFi is up, if the clock was never synced or its last sync is stale.
+ * configTime() only configures lwIP's SNTP client and returns; getLocalTime() is never called since it blocks.
+ */
+void serviceTimeSync()
+{
+  if (isSntpStarted || WiFi.status() != WL_CONNECTED)
+    return;
+
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  if (lastTimeSyncSec != 0 && now.tv_sec - lastTimeSyncSec < TIME_RESYNC_S)
+    return;
+
+  isSntpStarted = true;
+  sntp_set_time_sync_notification_cb(onTimeSync);
+  configTime(0, 0, NTP_SERVER);
+  Serial.printf("[TIME] SNTP started (%s), clock is '%s' until it answers.\n", NTP_SERVER,
+                CLOCK_QUALITY_NAMES[getClockQuality()]);
+}
+
+/**
+ * Stamps a reading with the device's Unix time in milliseconds, and how far that time can be trusted.
+ */
+void attachTimestamp(JsonDocument &doc)
+{
+  ClockQuality quality = getClockQuality();
+  doc["clock"] = CLOCK_QUALITY_NAMES[quality];
+  if (quality != CLOCK_NONE)
+  {
+    doc["sampledAt"] = wallClockUs() / 1000;
+  }
+}
 
 void enterDeepSleep(uint64_t time_ms)
 {
   Serial.println("Going to sleep to save battery...");
+  // Restored on wake-up, so a quiet wake (critical profile) can decide without the network
+  sleepThreshold = threshold;
+  sleepIsBinClosed = isBinClosed;
+  powerAccounting.update(esp_timer_get_time());
+  powerAccounting.markSleepStart(wallClockUs());
   Serial.flush();
   esp_sleep_enable_timer_wakeup(time_ms * 1000);
   esp_deep_sleep_start();
 }
 
-void connectToWifi()
+void onPingTimer(void *arg)
+{
+  isPingDue = true;
+  xTaskNotifyGive(loopTaskHandle);
+}
+
+/**
+ * Sets up DFS (80-240 MHz) with automatic light sleep, and the timer that paces the pings of a burst.
+ * Falls back to DFS only, then to manual frequency switching, depending on what the core was built with.
+ */
+void setupPowerManagement()
+{
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = &onPingTimer;
+  timerArgs.name = "ping";
+  esp_timer_create(&timerArgs, &pingTimer);
+
+  esp_pm_config_esp32_t config = {};
+  config.max_freq_mhz = CPU_FREQ_TLS_MHZ;
+  config.min_freq_mhz = CPU_FREQ_SAMPLING_MHZ;
+  config.light_sleep_enable = USE_LIGHT_SLEEP;
+  esp_err_t err = esp_pm_configure(&config);
+  if (err == ESP_ERR_NOT_SUPPORTED && config.light_sleep_enable)
+  {
+    // Core built without tickless idle, DFS may still work
+    config.light_sleep_enable = false;
+    err = esp_pm_configure(&config);
+  }
+
+  isPmEnabled = err == ESP_OK;
+  isLightSleepEnabled = isPmEnabled && config.light_sleep_enable;
+  if (isPmEnabled)
+  {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "tls", &cpuMaxLock);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "servo", &noLightSleepLock);
+  }
+  else
+  {
+    setCpuFrequencyMhz(CPU_FREQ_SAMPLING_MHZ);
+  }
+  Serial.printf("[POWER] DFS: %s | Light sleep: %s\n", isPmEnabled ? "on" : "off (manual)", isLightSleepEnabled ? "on" : "off");
+}
+
+/**
+ * Holds the CPU at 240 MHz (TLS handshake) or lets it drop back to 80 MHz.
+ */
+void requestMaxCpu(bool isRequested)
+{
+  if (isRequested == isCpuMaxHeld)
+    return;
+  isCpuMaxHeld = isRequested;
+  powerAccounting.set(POWER_TLS_HANDSHAKE, isRequested, esp_timer_get_time());
+
+  if (isPmEnabled)
+  {
+    if (isRequested)
+      esp_pm_lock_acquire(cpuMaxLock);
+    else
+      esp_pm_lock_release(cpuMaxLock);
+  }
+  else
+  {
+    setCpuFrequencyMhz(isRequested ? CPU_FREQ_TLS_MHZ : CPU_FREQ_SAMPLING_MHZ);
+  }
+}
+
+/**
+ * Keeps the chip out of light sleep for a while, e.g. until the servo has reached its position.
+ */
+void keepAwakeFor(unsigned long durationMs)
 {
+  awakeUntilTime = millis() + durationMs;
+  powerAccounting.set(POWER_SERVO, true, esp_timer_get_time());
+  if (isPmEnabled && !isNoLightSleepHeld)
+  {
+    esp_pm_lock_acquire(noLightSleepLock);
+    isNoLightSleepHeld = true;
+  }
+}
+
+void serviceAwakeLock(unsigned long now)
+{
+  if ((long)(now - awakeUntilTime) < 0)
+    return;
+
+  powerAccounting.set(POWER_SERVO, false, esp_timer_get_time());
+  if (isNoLightSleepHeld)
+  {
+    esp_pm_lock_release(noLightSleepLock);
+    isNoLightSleepHeld = false;
+  }
+}
+
+unsigned long cycleInterval()
+{
+  return CYCLE_INTERVAL * POWER_PROFILES[powerProfile].cycleMultiplier;
+}
+
+unsigned long summaryPeriod()
+{
+  return SUMMARY_PERIOD * POWER_PROFILES[powerProfile].summaryMultiplier;
+}
+
+bool isAlertOnly()
+{
+  return POWER_PROFILES[powerProfile].isAlertOnly;
+}
+
+/**
+ * Spreads the publish slot over the current profile's cycle and moves the next slot onto that grid.
+ */
+void updatePublishSlot()
+{
+  unsigned long interval = cycleInterval();
+  slotOffsetMs = hashDeviceId(DEVICE_ID) % interval;
+
+  unsigned long now = millis();
+  unsigned long phase = (now - slotAnchorMs) % interval;
+  nextSlotTime = now + (slotOffsetMs + interval - phase) % interval;
+  Serial.printf("Publish slot: +%lu ms within each %lu ms cycle\n", slotOffsetMs, interval);
+}
+
+/**
+ * Picks the profile for the battery level. Moving to a more aggressive profile is immediate,
+ * moving back requires the battery to be PROFILE_HYSTERESIS_PERCENT above the boundary.
+ */
+void updatePowerProfile(int batteryLevel)
+{
+  uint8_t target = PROFILE_NORMAL;
+  for (uint8_t profile = 0; profile < PROFILE_COUNT; profile++)
+  {
+    if (batteryLevel < POWER_PROFILES[profile].enterBelowPercent)
+      target = profile;
+  }
+  while (hasPowerProfile && target < powerProfile &&
+         batteryLevel < POWER_PROFILES[target + 1].enterBelowPercent + PROFILE_HYSTERESIS_PERCENT)
+  {
+    target++;
+  }
+
+  if (hasPowerProfile && target == powerProfile)
+    return;
+
+  Serial.printf("[POWER] Profile: %s -> %s (battery %d%%)\n",
+                hasPowerProfile ? POWER_PROFILES[powerProfile].name : "boot", POWER_PROFILES[target].name, batteryLevel);
+  bool isChange = hasPowerProfile;
+  hasPowerProfile = true;
+  powerProfile = target;
+  // Report the new profile with the next reading
+  isImmediatePublishPending = true;
+
+  // The boot profile is set before the slot grid exists, setup() places the first slot
+  if (isChange)
+  {
+    updatePublishSlot();
+  }
+}
+
+/**
+ * Starts the ping timer. The first ping is due immediately, the rest every SAMPLE_INTERVAL.
+ */
+void beginBurst()
+{
+  isSampling = true;
+  burstPingCount = 0;
+  currentReadings.clear();
+
+  burstStartUs = esp_timer_get_time();
+  burstSampleStartMs = millis();
+  burstIdleUs = 0;
+  burstPingUs = 0;
+  powerAccounting.set(POWER_SAMPLING, true, burstStartUs);
+
+  isPingDue = true;
+  esp_timer_start_periodic(pingTimer, SAMPLE_INTERVAL * 1000);
+}
+
+/**
+ * Stops the ping timer and logs the burst's estimated average current.
+ */
+void endBurst()
+{
+  esp_timer_stop(pingTimer);
+  isPingDue = false;
+  isSampling = false;
+  burstSampleEndMs = millis();
+
+  int64_t endUs = esp_timer_get_time();
+  powerAccounting.set(POWER_SAMPLING, false, endUs);
+  int64_t totalUs = endUs - burstStartUs;
+  if (totalUs <= 0)
+    return;
+
+  // Same current table as the power-state accounting, with the sensor only drawing while pinging
+  int64_t awakeUs = totalUs - burstIdleUs;
+  float idleCurrent = powerStateCurrentMa[isLightSleepEnabled ? POWER_LIGHT_SLEEP : POWER_MODEM_SLEEP];
+  float averageCurrent = (awakeUs * powerStateCurrentMa[POWER_MODEM_SLEEP] + burstIdleUs * idleCurrent +
+                          burstPingUs * powerStateCurrentMa[POWER_SAMPLING]) /
+                         totalUs;
+  Serial.printf("[POWER] Burst: %d pings in %lu ms | Awake %.0f%% (pings %lu ms) | Est. avg current %.1f mA\n",
+                burstPingCount, (unsigned long)(totalUs / 1000), 100.0 * awakeUs / totalUs,
+                (unsigned long)(burstPingUs / 1000), averageCurrent);
+}
+
+#if defined(MESH_RELAY_ENABLED)
+/**
+ * Without an AP connection, ESP-NOW sends on whatever channel the radio is on. The relays follow their AP,
+ * so use the AP's channel if a scan still sees it (too weak to connect is fine), otherwise MESH_CHANNEL.
+ */
+void joinMeshChannel()
+{
+  uint8_t channel = MESH_CHANNEL;
+  int count = WiFi.scanNetworks();
+  for (int i = 0; i < count; i++)
+  {
+    if (WiFi.SSID(i) == SSID)
+    {
+      channel = WiFi.channel(i);
+      break;
+    }
+  }
+  WiFi.scanDelete();
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  Serial.printf("[MESH] Using channel %u\n", channel);
+}
+#endif
+
+/**
+ * Connects to WiFi, giving up after 10s.
+ * Without a fallback (LoRaWAN or ESP-NOW relay) the device deep-sleeps on timeout, otherwise it returns false and keeps running.
+ */
+bool connectToWifi()
+{
+  lastWifiAttemptTime = millis();
   Serial.printf("Connecting to %s ", SSID);
   if (strcmp(SSID, "SOEN422") == 0)
   {
@@ -137,61 +837,451 @@ void connectToWifi()
     if (millis() - startTime > 10000)
     {
       Serial.println("\nWiFi Timeout! Router might be down.");
-      enterDeepSleep(5 * 60 * 1000);
+#if defined(LORAWAN_FALLBACK_ENABLED) || defined(MESH_RELAY_ENABLED)
+      Serial.println("Falling back to LoRaWAN / ESP-NOW relay until WiFi is back.");
+#if defined(MESH_RELAY_ENABLED)
+      // ESP-NOW needs the radio on, so only stop the background retries (we retry on our own schedule)
+      WiFi.setAutoReconnect(false);
+      WiFi.disconnect();
+      joinMeshChannel();
+#else
+      WiFi.disconnect(true); // Stop the background retries, we retry on our own schedule
+#endif
+      isOnFallback = true;
+      return false;
+#else
+      enterDeepSleep(WIFI_RETRY_INTERVAL_MS);
+#endif
     }
     delay(500);
     Serial.print(".");
   }
-  // This enables Modem Sleep. The radio turns off between DTIM intervals.
-  WiFi.setSleep(true);
+  // Modem Sleep turns the radio off between DTIM intervals (off in mesh builds, see USE_MODEM_SLEEP)
+  WiFi.setSleep(USE_MODEM_SLEEP);
 
   Serial.println("\nConnected to WiFi!");
   Serial.print("IP Address: ");
   Serial.println(WiFi.localIP());
+  isOnFallback = false;
+  return true;
+}
+
+void subscribeGroupConfig()
+{
+  Serial.printf("Subscribing to group config: %s\n", binGroup.c_str());
+  mqtt.subscribe(MQTT::Topics::getGroupConfig(binGroup.c_str()), CONFIG_QOS, [](const String &payload, const size_t size)
+                 { handleConfig(CONFIG_GROUP, payload); });
+}
+
+/**
+ * Returns the threshold of the most specific config source that is set.
+ */
+int resolveThreshold()
+{
+  for (int source = CONFIG_SOURCE_COUNT - 1; source >= 0; source--)
+  {
+    if (thresholdBySource[source] != THRESHOLD_UNSET)
+      return thresholdBySource[source];
+  }
+  return DEFAULT_THRESHOLD;
+}
+
+/**
+ * Moves the bin to a new group (empty string leaves any group).
+ * The membership is persisted, and the old group's threshold no longer applies.
+ */
+void setGroup(const char *group)
+{
+  if (binGroup == group)
+    return;
+
+  // MQTT wildcards or separators would subscribe to more than one group
+  if (strlen(group) > MAX_GROUP_NAME_LENGTH || strpbrk(group, "/+#") != nullptr)
+  {
+    Serial.printf("Rejected invalid group name: %s\n", group);
+    return;
+  }
+
+  if (binGroup.length() > 0)
+  {
+    mqtt.unsubscribe(MQTT::Topics::getGroupConfig(binGroup.c_str()));
+  }
+
+  binGroup = group;
+  thresholdBySource[CONFIG_GROUP] = THRESHOLD_UNSET;
+  preferences.putString("group", binGroup);
+  Serial.printf("Group set to: %s\n", binGroup.length() > 0 ? binGroup.c_str() : "(none)");
+
+  if (binGroup.length() > 0)
+  {
+    subscribeGroupConfig();
+  }
+}
+
+const char *PREF_CURRENT_TABLE = "currents";
+
+void loadCurrentTable()
+{
+  memcpy(powerStateCurrentMa, DEFAULT_POWER_STATE_CURRENT_MA, sizeof(powerStateCurrentMa));
+  if (preferences.getBytesLength(PREF_CURRENT_TABLE) == sizeof(powerStateCurrentMa))
+  {
+    preferences.getBytes(PREF_CURRENT_TABLE, powerStateCurrentMa, sizeof(powerStateCurrentMa));
+  }
+}
+
+/**
+ * Overrides the current of the states present in the object, keyed by POWER_STATE_NAMES, and persists the table.
+ */
+void setCurrentTable(JsonObjectConst table)
+{
+  bool isChanged = false;
+  for (uint8_t state = 0; state < POWER_STATE_COUNT; state++)
+  {
+    JsonVariantConst value = table[POWER_STATE_NAMES[state]];
+    if (value.is<float>() && value.as<float>() >= 0 && value.as<float>() != powerStateCurrentMa[state])
+    {
+      powerStateCurrentMa[state] = value.as<float>();
+      isChanged = true;
+    }
+  }
+
+  if (isChanged)
+  {
+    preferences.putBytes(PREF_CURRENT_TABLE, powerStateCurrentMa, sizeof(powerStateCurrentMa));
+    Serial.println("[POWER] Current table updated.");
+  }
+}
+
+/**
+ * Applies a config message from any source. Payload fields (all optional):
+ *  - "threshold": new threshold for this source
+ *  - "inherit": true clears this source's threshold so less specific sources apply again
+ *  - "group": group name, only accepted from the device's own config topic
+ *  - "currentTable": {"modemSleep": 22.5, ...} recalibrates the power-state currents (mA)
+ *  - "requestId": echoed back in the sample triggered by a threshold change
+ */
+void handleConfig(ConfigSource source, const String &payload)
+{
+  Serial.printf("Received %s config update: %s\n", CONFIG_SOURCE_NAMES[source], payload.c_str());
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, payload);
+  if (error)
+  {
+    Serial.println("Failed to parse config JSON");
+    return;
+  }
+
+  if (source == CONFIG_DEVICE && doc["group"].is<const char *>())
+  {
+    setGroup(doc["group"].as<const char *>());
+  }
+
+  if (doc["currentTable"].is<JsonObjectConst>())
+  {
+    setCurrentTable(doc["currentTable"].as<JsonObjectConst>());
+  }
+
+  if (source == CONFIG_DEVICE && isConfigPending)
+  {
+    // First device config after a fresh subscribe (retained or get-config reply): the session is now ready
+    isConfigPending = false;
+    markConnectReady("clean session");
+  }
+
+  if (doc["inherit"] | false)
+  {
+    thresholdBySource[source] = THRESHOLD_UNSET;
+  }
+  else if (doc["threshold"].is<int>())
+  {
+    thresholdBySource[source] = doc["threshold"];
+  }
+
+  int newThreshold = resolveThreshold();
+  if (newThreshold != threshold)
+  {
+    threshold = newThreshold;
+    Serial.printf("New Threshold Set: %d%%\n", threshold);
+    // Request a sample to apply new threshold logic
+    requestSampling(doc["requestId"] | "");
+  }
+  else
+  {
+    Serial.println("Threshold unchanged, no sample needed.");
+  }
+}
+
+// --- Bin Geometry & Calibration ---
+const char *PREF_EMPTY_DISTANCE = "emptyCm";
+const char *PREF_VOLUME_TABLE = "volTable";
+
+/**
+ * Bounds the sensor's echo wait to the bin's depth instead of the full 4m range.
+ */
+void applyEchoRange()
+{
+  distanceSensor.setMaxDistanceCm(binGeometry.getMaxRangeCm());
+  Serial.printf("[GEOMETRY] Empty: %.1fcm | Range: %ucm | Echo timeout: %luus | Volume points: %u\n",
+                binGeometry.getEmptyDistanceCm(), binGeometry.getMaxRangeCm(),
+                (unsigned long)binGeometry.getEchoTimeoutUs(), binGeometry.getVolumeTableSize());
+}
+
+void loadBinGeometry()
+{
+  binGeometry.setEmptyDistanceCm(preferences.getFloat(PREF_EMPTY_DISTANCE, BIN_HEIGHT_CM));
+
+  VolumePoint points[BinGeometry::MAX_POINTS];
+  size_t length = preferences.getBytesLength(PREF_VOLUME_TABLE);
+  if (length > 0 && length <= sizeof(points) && length % sizeof(VolumePoint) == 0)
+  {
+    preferences.getBytes(PREF_VOLUME_TABLE, points, length);
+    binGeometry.setVolumeTable(points, length / sizeof(VolumePoint));
+  }
+  applyEchoRange();
+}
+
+void setEmptyDistance(float distance)
+{
+  binGeometry.setEmptyDistanceCm(distance);
+  preferences.putFloat(PREF_EMPTY_DISTANCE, distance);
+  // The filter's window holds distances against the old geometry
+  cycleFilter.reset();
+}
+
+/**
+ * Parses [[distanceCm, fillPercent], ...]. An empty array clears the table.
+ */
+bool setVolumeTable(JsonArrayConst table)
+{
+  VolumePoint points[BinGeometry::MAX_POINTS];
+  uint8_t count = 0;
+  for (JsonArrayConst point : table)
+  {
+    if (count >= BinGeometry::MAX_POINTS || point.size() != 2)
+      return false;
+    points[count].distanceCm = point[0].as<float>();
+    points[count].fillPercent = point[1].as<float>();
+    count++;
+  }
+
+  if (!binGeometry.setVolumeTable(points, count))
+    return false;
+
+  if (count == 0)
+  {
+    preferences.remove(PREF_VOLUME_TABLE);
+  }
+  else
+  {
+    preferences.putBytes(PREF_VOLUME_TABLE, binGeometry.getVolumeTable(), binGeometry.getVolumeTableSize() * sizeof(VolumePoint));
+  }
+  return true;
+}
+
+void publishCalibration(bool isSuccess, size_t sampleCount)
+{
+  JsonDocument doc;
+  doc["deviceId"] = DEVICE_ID;
+  doc["success"] = isSuccess;
+  doc["emptyDistanceCm"] = round(binGeometry.getEmptyDistanceCm() * 10.0) / 10.0;
+  doc["maxRangeCm"] = binGeometry.getMaxRangeCm();
+  doc["echoTimeoutUs"] = binGeometry.getEchoTimeoutUs();
+  doc["volumePoints"] = binGeometry.getVolumeTableSize();
+  doc["samples"] = sampleCount;
+  if (calibrationRequestId.length() > 0)
+  {
+    doc["requestId"] = calibrationRequestId;
+  }
+
+  if (mqtt.isConnected())
+  {
+    String payload;
+    serializeJson(doc, payload);
+    mqtt.publish(MQTT::Topics::getCalibration(DEVICE_ID), payload);
+  }
+}
+
+/**
+ * Install-time calibration command. Payload fields (all optional):
+ *  - "emptyDistanceCm": set the empty distance directly instead of measuring it
+ *  - "volumeTable": [[distanceCm, fillPercent], ...] for tapered bins, [] clears it
+ *  - "requestId": echoed in the result on bins/{id}/calibration
+ * An empty payload measures the empty bin. Sending only a table keeps the current empty distance.
+ */
+void handleCalibrate(const String &payload)
+{
+  JsonDocument doc;
+  if (payload.length() > 0 && deserializeJson(doc, payload))
+  {
+    Serial.println("Failed to parse calibrate JSON");
+    return;
+  }
+  calibrationRequestId = doc["requestId"] | "";
+
+  bool isValid = true;
+  if (doc["volumeTable"].is<JsonArrayConst>())
+  {
+    isValid = setVolumeTable(doc["volumeTable"].as<JsonArrayConst>());
+    if (!isValid)
+    {
+      Serial.println("[GEOMETRY] Rejected volume table (needs 2-16 points, fill decreasing with distance).");
+    }
+  }
+
+  if (doc["emptyDistanceCm"].is<float>())
+  {
+    float distance = doc["emptyDistanceCm"];
+    if (distance > MIN_VALID_CM && distance <= MAX_DISTANCE_CM)
+    {
+      setEmptyDistance(distance);
+    }
+    else
+    {
+      isValid = false;
+    }
+  }
+  else if (!doc["volumeTable"].is<JsonArrayConst>())
+  {
+    // Measure the empty bin once the current burst (if any) is done
+    isCalibrationPending = true;
+    return;
+  }
+
+  applyEchoRange();
+  publishCalibration(isValid, 0);
+}
+
+/**
+ * Starts a sampling burst at the sensor's full range. Unlike triggerSampling(),
+ * this leaves pending remote triggers alone: they still get a normal reading afterwards.
+ */
+void startCalibration()
+{
+  isCalibrationPending = false;
+  isCalibrating = true;
+  distanceSensor.setMaxDistanceCm(MAX_DISTANCE_CM);
+
+  beginBurst();
+  Serial.println("[GEOMETRY] Calibrating empty-bin distance...");
+}
+
+void finishCalibration(float distance, size_t sampleCount)
+{
+  isCalibrating = false;
+
+  // Most of the burst must see the floor, otherwise the bin is probably not empty or not mounted yet
+  bool isSuccess = distance > MIN_VALID_CM && sampleCount > TARGET_SAMPLES / 2;
+  if (isSuccess)
+  {
+    setEmptyDistance(distance);
+  }
+  else
+  {
+    Serial.printf("[GEOMETRY] Calibration failed (%u valid samples), keeping %.1fcm.\n", sampleCount, binGeometry.getEmptyDistanceCm());
+  }
+
+  applyEchoRange();
+  publishCalibration(isSuccess, sampleCount);
+}
+
+void setupMqttSubscriptions()
+{
+  mqtt.subscribe(MQTT::Topics::getPing(DEVICE_ID), [](const String &payload, const size_t size)
+                 {
+        Serial.println("!!! FORCING SAMPLE !!!");
+        // Payload is optional: {"requestId": "..."}
+        JsonDocument doc;
+        const char *requestId = "";
+        if (size > 0 && !deserializeJson(doc, payload)) {
+            requestId = doc["requestId"] | "";
+        }
+        requestSampling(requestId); });
+
+  mqtt.subscribe(MQTT::Topics::getConfig(DEVICE_ID), CONFIG_QOS, [](const String &payload, const size_t size)
+                 { handleConfig(CONFIG_DEVICE, payload); });
+
+  mqtt.subscribe(MQTT::Topics::getCalibrate(DEVICE_ID), [](const String &payload, const size_t size)
+                 { handleCalibrate(payload); });
+
+  mqtt.subscribe(MQTT::Topics::getFleetConfig(), CONFIG_QOS, [](const String &payload, const size_t size)
+                 { handleConfig(CONFIG_ALL, payload); });
+
+  if (binGroup.length() > 0)
+  {
+    subscribeGroupConfig();
+  }
+}
+
+void requestThreshold()
+{
+  Serial.println("Requesting threshold from server...");
+  mqtt.publish(MQTT::Topics::requestConfig(DEVICE_ID), "{}");
+}
+
+/**
+ * Starts the reconnect-to-ready timer, unless a connect is already being timed.
+ */
+void markConnectStart()
+{
+  if (!isTimingConnect)
+  {
+    isTimingConnect = true;
+    connectStartTime = millis();
+  }
+  requestMaxCpu(true);
 }
 
-void setupMqttSubscriptions()
+/**
+ * Stops the reconnect-to-ready timer and logs how long it took until subscriptions and config were in place.
+ */
+void markConnectReady(const char *detail)
 {
-  mqtt.subscribe(MQTT::Topics::getPing(DEVICE_ID), [](const String &payload, const size_t size)
-                 {
-        Serial.println("!!! FORCING SAMPLE !!!");
-        triggerSampling(); });
-
-  mqtt.subscribe(MQTT::Topics::getConfig(DEVICE_ID), [](const String &payload, const size_t size)
-                 {
-    Serial.printf("Received config update: %s\n", payload.c_str());
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, payload);
-    if (!error) {
-        if (doc["threshold"].is<int>()) {
-            threshold = doc["threshold"];
-            Serial.printf("New Threshold Set: %d%%\n", threshold);
-            // Trigger a sample immediately to apply new threshold logic
-            triggerSampling();
-        }
-    } else {
-        Serial.println("Failed to parse config JSON");
-    } });
+  if (!isTimingConnect)
+    return;
+
+  isTimingConnect = false;
+  requestMaxCpu(false);
+  lastConnectDurationMs = millis() - connectStartTime;
+  brokerConnectCount++;
+  Serial.printf("[NET] Broker ready in %lu ms (%s, %s, connect #%u since power-on). Free Heap: %u bytes\n",
+                lastConnectDurationMs, hasConnectedOnce ? "reconnect" : "boot", detail, brokerConnectCount, esp_get_free_heap_size());
+  hasConnectedOnce = true;
 }
 
-void requestThreshold()
+#if !defined(TRANSPORT_WSS)
+/**
+ * Opens the socket to the broker. On the TLS transport the broker certificate is pinned
+ * through setCACert(), and additionally through its SHA-256 fingerprint if one is configured.
+ */
+bool connectTransport()
 {
-  Serial.println("Requesting threshold from server...");
-  mqtt.publish(MQTT::Topics::requestConfig(DEVICE_ID), "{}");
+  if (!client.connect(BROKER_URL, BROKER_PORT))
+    return false;
+
+#if defined(TRANSPORT_TLS) && defined(MQTT_BROKER_FINGERPRINT)
+  if (!client.verify(MQTT_BROKER_FINGERPRINT, BROKER_URL))
+  {
+    Serial.println("[TLS] Broker certificate fingerprint mismatch! Closing connection.");
+    client.stop();
+    return false;
+  }
+#endif
+  return true;
 }
+#endif
 
 void connectToMqtt()
 {
   Serial.print("Connecting to MQTT broker... ");
 
-#if defined(PRODUCTION_BUILD)
+#if defined(TRANSPORT_WSS)
   // WebSocketsClient handles reconnection internally in its loop,
 #else
   if (!client.connected())
   {
     Serial.print("Re-establishing TCP... ");
     client.stop();
-    if (!client.connect(BROKER_URL, BROKER_PORT))
+    if (!connectTransport())
     {
       Serial.println("TCP Failed. Retrying later.");
       delay(2000);
@@ -208,17 +1298,34 @@ void connectToMqtt()
 
   if (mqtt.connect(clientId.c_str(), MQTT_USER, MQTT_PASS))
   {
-    Serial.println(" MQTT Connected!");
-    setupMqttSubscriptions();
-    mqtt.publish(statusTopic, "online", true, 0); // Announce we are Online immediately
-    requestThreshold();
+    // Local callbacks survive reconnects, so a resumed broker session needs nothing re-sent.
+    // Config missed while offline is queued by the broker (QoS 1 subscriptions) and arrives right after this.
+    bool isSessionResumed = USE_PERSISTENT_SESSION && hasSubscribed && mqtt.sessionPresent();
+    Serial.println(isSessionResumed ? " MQTT Connected! (session resumed)" : " MQTT Connected!");
+
+    if (isSessionResumed)
+    {
+      mqtt.publish(statusTopic, "online", true, 0); // Announce we are Online immediately
+      markConnectReady("session resumed");
+    }
+    else
+    {
+      setupMqttSubscriptions();
+      hasSubscribed = true;
+      mqtt.publish(statusTopic, "online", true, 0); // Announce we are Online immediately
+
+      // The retained config arrives with the subscription. get-config is only a fallback (see loop)
+      isConfigPending = true;
+      isConfigRequested = false;
+      configRequestDeadline = millis() + (USE_PERSISTENT_SESSION ? CONFIG_WAIT_MS : 0);
+    }
   }
   else
   {
     Serial.print(" MQTT Failed (Error: ");
     Serial.print(mqtt.getLastError());
     Serial.println(")");
-#if !defined(PRODUCTION_BUILD)
+#if !defined(TRANSPORT_WSS)
     client.stop(); // force close TCP to start fresh next time
 #endif
     delay(2000);
@@ -227,6 +1334,10 @@ void connectToMqtt()
 
 void setup()
 {
+  // Book the deep sleep we just woke up from (nothing after power-on)
+  powerAccounting.begin(esp_timer_get_time());
+  powerAccounting.markWake(wallClockUs());
+
   Serial.begin(115200);
   while (!Serial)
   {
@@ -242,47 +1353,102 @@ void setup()
   pinMode(RED_LED_PIN, OUTPUT);
   digitalWrite(RED_LED_PIN, LOW); // Start Off
 
+  // --- Tilt Sensor Setup ---
+  tiltSensor.begin();
+
+  // --- Battery Pin Setup ---
+  pinMode(BATTERY_PIN, INPUT);
+
+  // --- Persisted Settings ---
+  preferences.begin("smart-bin", false);
+  binGroup = preferences.getString("group", "");
+  Serial.printf("Group: %s\n", binGroup.length() > 0 ? binGroup.c_str() : "(none)");
+  loadBinGeometry();
+  loadCurrentTable();
+  // Lid state and threshold from before the last deep sleep (defaults after power-on)
+  threshold = sleepThreshold;
+  isBinClosed = sleepIsBinClosed;
+
+  // --- Battery Power Profile ---
+  updatePowerProfile(getBatteryPercentage(readBatteryVoltage()));
+  runQuietWake(); // Critical profile: may go straight back to deep sleep, before the servo or WiFi wake up
+
   // --- Servo Setup ---
   ESP32PWM::allocateTimer(SERVO_TIMER_ID);
   servo.setPeriodHertz(SERVO_PERIOD);
   servo.attach(SERVO_DATA_PIN, SERVO_MIN, SERVO_MAX);
 
-  // --- Tilt Sensor Setup ---
-  tiltSensor.begin();
+  // --- Power Management Setup ---
+  setupPowerManagement();
 
-  // --- Battery Pin Setup ---
-  pinMode(BATTERY_PIN, INPUT);
+#if defined(LORAWAN_FALLBACK_ENABLED)
+  // --- LoRaWAN Setup ---
+  os_init();
+  LMIC_reset();
+#endif
 
-  connectToWifi();
+  bool isWifiConnected = connectToWifi();
+
+#if defined(MESH_RELAY_ENABLED)
+  // --- ESP-NOW Relay Setup ---
+  setupMesh();
+#endif
+
+  markConnectStart();
 
 // --- Configure the correct client ---
-#if defined(PRODUCTION_BUILD)
+#if defined(TRANSPORT_TLS)
+  Serial.println("Mode: PRODUCTION (native MQTT over TLS)");
+  client.setCACert(MQTT_BROKER_CA_CERT);
+  client.setTimeout(5000);
+  if (!connectTransport())
+  {
+    Serial.println("Initial TLS connection failed.");
+  }
+#elif defined(TRANSPORT_WSS)
   Serial.println("Mode: PRODUCTION (WSS)");
   client.beginSSL(BROKER_URL, BROKER_PORT, "/", "", "mqtt");
   client.setReconnectInterval(3000);
 #else
   Serial.println("Mode: DEVELOPMENT (unsecured MQTT)");
   client.setTimeout(5000);
-  if (!client.connect(BROKER_URL, BROKER_PORT))
+  if (!connectTransport())
   {
     Serial.println("Initial TCP failed.");
   }
 #endif
 
   mqtt.begin(client);
+  mqtt.setCleanSession(!USE_PERSISTENT_SESSION);
 
   // mqtt.subscribe([](const String &topic, const String &payload, size_t size)
   //                { Serial.printf("[Global] Topic: %s, Payload: %s\n", topic.c_str(), payload.c_str()); });
 
-  while (!mqtt.isConnected())
+  while (isWifiConnected && !mqtt.isConnected())
   {
     connectToMqtt();
     if (!mqtt.isConnected())
       delay(3000);
   }
 
-  // Ensure bin is opened at startup by default
-  openBin();
+  // Ensure bin is opened at startup by default, unless it was closed before a deep sleep
+  if (isBinClosed)
+  {
+    closeBin();
+  }
+  else
+  {
+    openBin();
+  }
+
+  slotAnchorMs = millis();
+  updatePublishSlot();
+
+  // Critical profile: the device is only awake to report, don't wait for the slot
+  if (isAlertOnly())
+  {
+    triggerSampling();
+  }
 
   Serial.println("Heap Memory After Setup:");
   Serial.printf("Free Heap: %u bytes, Max Contiguous Block: %u bytes\n", esp_get_free_heap_size(), heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
@@ -290,15 +1456,19 @@ void setup()
 
 void openBin()
 {
+  isBinClosed = false;
   Serial.println("[ACTUATOR] Opening bin (Under Threshold)");
   digitalWrite(RED_LED_PIN, LOW);
+  keepAwakeFor(SERVO_SETTLE_MS);
   servo.write(SERVO_BIN_OPEN_POS);
 }
 
 void closeBin()
 {
+  isBinClosed = true;
   Serial.println("[ACTUATOR] Closing bin (Over Threshold)");
   digitalWrite(RED_LED_PIN, HIGH);
+  keepAwakeFor(SERVO_SETTLE_MS);
   servo.write(SERVO_BIN_CLOSED_POS);
 }
 
@@ -332,18 +1502,128 @@ float processReadings(std::vector<float> &readings)
   return sum / count;
 }
 
+/**
+ * 32-bit FNV-1a hash. The fleet simulator (web/src/sim) uses the same function to predict slots.
+ */
+uint32_t hashDeviceId(const char *id)
+{
+  uint32_t hash = 2166136261UL;
+  while (*id)
+  {
+    hash ^= (uint8_t)*id++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
 void triggerSampling()
 {
   if (!isSampling)
   {
-    isSampling = true;
-    lastCycleTime = millis();
-    lastSampleTime = millis() - SAMPLE_INTERVAL;
-    currentReadings.clear();
+    beginBurst();
+    // Any pending remote trigger is served by this burst
+    remoteTriggerPending = false;
     Serial.println("Starting sampling burst...");
   }
 }
 
+/**
+ * Remote sampling request (ping or config change).
+ * Joins the in-progress burst if there is one, otherwise marks a trigger as pending
+ * so serviceRemoteTrigger() can start a burst once the rate limits allow it.
+ */
+void requestSampling(const char *requestId)
+{
+  burstTriggerCount++;
+  if (requestId != nullptr && requestId[0] != '\0')
+  {
+    if (burstRequestIdCount < MAX_REQUEST_IDS)
+    {
+      strlcpy(burstRequestIds[burstRequestIdCount], requestId, REQUEST_ID_LENGTH);
+      burstRequestReceivedMs[burstRequestIdCount] = millis();
+      burstRequestIdCount++;
+    }
+    else
+    {
+      Serial.printf("[TRIGGER] Request id list full, '%s' will not be echoed.\n", requestId);
+    }
+  }
+
+  if (isSampling && !isCalibrating)
+  {
+    isBurstJoined = true;
+    Serial.println("[TRIGGER] Coalesced into in-progress burst.");
+    return;
+  }
+  if (remoteTriggerPending)
+  {
+    Serial.println("[TRIGGER] Coalesced into pending burst.");
+    return;
+  }
+  remoteTriggerPending = true;
+}
+
+/**
+ * Starts a burst for a pending remote trigger, respecting the minimum spacing and the per-window budget.
+ * When the budget is exhausted the trigger stays pending and is served by the next periodic cycle.
+ */
+void serviceRemoteTrigger(unsigned long now)
+{
+  if (!remoteTriggerPending || isSampling)
+    return;
+
+  if (now - lastRemoteBurstTime < MIN_TRIGGER_SPACING_MS)
+    return;
+
+  if (now - triggerWindowStart >= TRIGGER_BUDGET_WINDOW_MS)
+  {
+    triggerWindowStart = now;
+    triggerWindowCount = 0;
+  }
+  if (triggerWindowCount >= TRIGGER_BUDGET)
+    return;
+
+  triggerWindowCount++;
+  lastRemoteBurstTime = now;
+  triggerSampling();
+}
+
+/**
+ * Echoes the request ids served by this burst, then clears them for the next one.
+ * With ids, also adds the device-side timestamps (millis()) the backend splits the latency with:
+ * "timing": {"receivedMs": [per id], "sampleStartMs", "sampleEndMs", "publishMs"}. publishMs is
+ * filled in by publishReading() right before the message leaves.
+ */
+void attachRequestIds(JsonDocument &doc)
+{
+  if (burstTriggerCount == 0)
+    return;
+
+  JsonArray ids = doc["requestIds"].to<JsonArray>();
+  for (uint8_t i = 0; i < burstRequestIdCount; i++)
+  {
+    ids.add(burstRequestIds[i]);
+  }
+  // Also when a single trigger joined a running burst (e.g. a periodic one): part of its sample predates the request
+  doc["coalesced"] = burstTriggerCount > 1 || isBurstJoined;
+
+  if (burstRequestIdCount > 0)
+  {
+    JsonObject timing = doc["timing"].to<JsonObject>();
+    JsonArray received = timing["receivedMs"].to<JsonArray>();
+    for (uint8_t i = 0; i < burstRequestIdCount; i++)
+    {
+      received.add(burstRequestReceivedMs[i]);
+    }
+    timing["sampleStartMs"] = burstSampleStartMs;
+    timing["sampleEndMs"] = burstSampleEndMs;
+  }
+
+  burstRequestIdCount = 0;
+  burstTriggerCount = 0;
+  isBurstJoined = false;
+}
+
 struct BatteryMap
 {
   float voltage;
@@ -409,21 +1689,324 @@ float readBatteryVoltage()
   return voltage + VOLTAGE_CALIBRATION;
 }
 
+/**
+ * Sends a reading over MQTT while the broker is reachable, otherwise through an ESP-NOW relay or LoRaWAN (if enabled).
+ */
+void publishReading(JsonDocument &doc)
+{
+  if (mqtt.isConnected())
+  {
+    doc["powerProfile"] = POWER_PROFILES[powerProfile].name;
+    if (doc["timing"].is<JsonObject>())
+    {
+      doc["timing"]["publishMs"] = millis();
+    }
+    char output[640]; // Room for 4 request ids and their timing
+    size_t outputLength = serializeJson(doc, output);
+    unsigned long publishStartUs = micros();
+    mqtt.publish(MQTT::Topics::getData(DEVICE_ID), output);
+    Serial.printf("Published (%u bytes in %lu us): ", outputLength, micros() - publishStartUs);
+    Serial.println(output);
+    return;
+  }
+
+#if defined(LORAWAN_FALLBACK_ENABLED) || defined(MESH_RELAY_ENABLED)
+  BinReading reading;
+  reading.fillLevel = doc["fillLevel"];
+  reading.batteryPercentage = doc["batteryPercentage"];
+  reading.isTilted = doc["isTilted"];
+#endif
+
+#if defined(MESH_RELAY_ENABLED)
+#if defined(LORAWAN_FALLBACK_ENABLED)
+  // LoRa airtime is scarce, so it is only used when no relay is in range
+  if (meshRelay.hasRelay(millis()))
+#endif
+  {
+    MeshReading meshReading;
+    meshReading.reading = reading;
+    meshReading.voltageMv = (uint16_t)(doc["voltage"].as<float>() * 1000);
+    meshRelay.queue(meshReading);
+    Serial.printf("[MESH] Broker unreachable, queued for relay: Fill %d%%, Battery %d%%, Tilted %d\n",
+                  reading.fillLevel, reading.batteryPercentage, reading.isTilted);
+    return;
+  }
+#endif
+
+#if defined(LORAWAN_FALLBACK_ENABLED)
+  loraUplink.queue(reading);
+  Serial.printf("[LORA] Broker unreachable, queued uplink: Fill %d%%, Battery %d%%, Tilted %d\n",
+                reading.fillLevel, reading.batteryPercentage, reading.isTilted);
+#else
+  Serial.println("Broker unreachable, reading dropped.");
+#endif
+}
+
+#if defined(MESH_RELAY_ENABLED)
+void setupMesh()
+{
+  if (esp_now_init() != ESP_OK)
+  {
+    Serial.println("[MESH] ESP-NOW init failed, relaying disabled.");
+    return;
+  }
+  meshRxQueue = xQueueCreate(8, sizeof(MeshFrame));
+  esp_now_register_recv_cb(onMeshReceive);
+  // Every wake is a reboot, a fixed start would repeat the seq the relay saw last
+  meshRelay.seedSeq((uint8_t)esp_random());
+
+#if defined(MESH_ALLOWED_ORIGINS)
+  meshRelay.setAllowedOrigins(MESH_ORIGINS, sizeof(MESH_ORIGINS) / sizeof(MESH_ORIGINS[0]));
+#else
+  Serial.println("[MESH] MESH_ALLOWED_ORIGINS not set, not relaying for other bins.");
+#endif
+  if (!isValidMeshId(BIN_ID))
+  {
+    Serial.println("[MESH] BIN_ID is not a valid mesh id (letters, digits, '-', '_'), relays will ignore this bin.");
+  }
+}
+
+/**
+ * Publishes a reading received from another bin under that bin's own topic.
+ */
+void publishRelayed(const RelayedReading &relayed)
+{
+  JsonDocument doc;
+  doc["deviceId"] = relayed.originId;
+  doc["fillLevel"] = relayed.data.reading.fillLevel;
+  doc["batteryPercentage"] = relayed.data.reading.batteryPercentage;
+  doc["voltage"] = round(relayed.data.voltageMv / 10.0) / 100.0;
+  doc["isTilted"] = relayed.data.reading.isTilted;
+  doc["relayedBy"] = DEVICE_ID;
+
+  char output[256];
+  serializeJson(doc, output);
+  mqtt.publish(MQTT::Topics::getData(relayed.originId), output);
+  Serial.printf("[MESH] Relayed for %s: %s\n", relayed.originId, output);
+}
+
+void serviceMesh(unsigned long now)
+{
+  if (meshRxQueue == nullptr)
+    return;
+
+  MeshFrame frame;
+  while (xQueueReceive(meshRxQueue, &frame, 0) == pdTRUE)
+  {
+    meshRelay.onReceive(frame.mac, frame.data, frame.length, now);
+  }
+
+  meshRelay.setUplink(mqtt.isConnected());
+  meshRelay.service(now);
+
+  RelayedReading relayed;
+  while (meshRelay.popRelayed(relayed))
+  {
+    publishRelayed(relayed);
+  }
+}
+#endif
+
+/**
+ * Publishes the aggregated summary once per SUMMARY_PERIOD and starts a new period.
+ * If the broker is unreachable the period keeps running and is sent on the next call.
+ */
+void serviceSummary(unsigned long now)
+{
+  if (!USE_AGGREGATION || summaryPeriod() == 0 || now - lastSummaryTime < summaryPeriod())
+    return;
+  if (aggregator.isEmpty() || !mqtt.isConnected())
+    return;
+
+  float voltage = readBatteryVoltage();
+
+  JsonDocument doc;
+  doc["deviceId"] = DEVICE_ID;
+  doc["periodMs"] = now - lastSummaryTime;
+  doc["samples"] = aggregator.getCount();
+  doc["fillMin"] = aggregator.getFillMin();
+  doc["fillMax"] = aggregator.getFillMax();
+  doc["fillMean"] = round(aggregator.getFillMean() * 10.0) / 10.0;
+  doc["fillLast"] = aggregator.getFillLast();
+  doc["batteryPercentage"] = aggregator.getBatteryLast();
+  doc["batteryTrend"] = round(aggregator.getBatteryTrendPerHour() * 100.0) / 100.0; // %/hour
+  doc["voltage"] = round(voltage * 100.0) / 100.0;
+  doc["outlierCount"] = cycleFilter.getRejectedCount();
+  attachTimestamp(doc); // End of the period
+  doc["powerProfile"] = POWER_PROFILES[powerProfile].name;
+
+  char output[384];
+  serializeJson(doc, output);
+  mqtt.publish(MQTT::Topics::getSummary(DEVICE_ID), output);
+  Serial.print("Published Summary: ");
+  Serial.println(output);
+
+  aggregator.reset();
+  lastSummaryTime = now;
+}
+
+/**
+ * Publishes the time per power state since power-on, and the battery life it projects.
+ */
+void publishMetrics()
+{
+  if (!mqtt.isConnected())
+    return;
+
+  powerAccounting.update(esp_timer_get_time());
+  float voltage = readBatteryVoltage();
+  int batteryLevel = getBatteryPercentage(voltage);
+  float averageCurrent = powerAccounting.getAverageCurrentMa();
+
+  JsonDocument doc;
+  doc["deviceId"] = DEVICE_ID;
+  JsonObject stateMs = doc["stateMs"].to<JsonObject>();
+  for (uint8_t state = 0; state < POWER_STATE_COUNT; state++)
+  {
+    stateMs[POWER_STATE_NAMES[state]] = powerAccounting.getTimeUs((PowerState)state) / 1000;
+  }
+  doc["avgCurrentMa"] = round(averageCurrent * 100.0) / 100.0;
+  doc["batteryPercentage"] = batteryLevel;
+  doc["projectedLifeHours"] = round(powerAccounting.getProjectedLifeHours(BATTERY_CAPACITY_MAH * batteryLevel / 100.0));
+  doc["fullChargeLifeHours"] = round(powerAccounting.getProjectedLifeHours(BATTERY_CAPACITY_MAH));
+  doc["powerProfile"] = POWER_PROFILES[powerProfile].name;
+
+  char output[512];
+  serializeJson(doc, output);
+  mqtt.publish(MQTT::Topics::getMetrics(DEVICE_ID), output);
+  Serial.print("Published Metrics: ");
+  Serial.println(output);
+}
+
+void serviceMetrics(unsigned long now)
+{
+  if (now - lastMetricsTime < METRICS_PERIOD || !mqtt.isConnected())
+    return;
+
+  publishMetrics();
+  lastMetricsTime = now;
+}
+
+/**
+ * Arms the tilt wake-up for the opposite of the current state, so both tipping over
+ * and being set upright wake the device. RBS 040100: LOW when upright.
+ */
+void armTiltWakeup()
+{
+  rtc_gpio_pullup_en((gpio_num_t)TILT_PIN);
+  rtc_gpio_pulldown_dis((gpio_num_t)TILT_PIN);
+  esp_sleep_enable_ext0_wakeup((gpio_num_t)TILT_PIN, tiltSensor.isTilted() ? 0 : 1);
+}
+
+/**
+ * Critical profile: deep sleep until the next cycle once the alert (if any) is out.
+ * Stays awake while something is still pending, and on a fallback: the LMIC session only lives in RAM,
+ * and an ESP-NOW origin has to hear its relay's beacons.
+ */
+void sleepUntilNextCycle()
+{
+  if (isSampling || isRecoveryPending || isCalibrationPending || remoteTriggerPending || isOnFallback)
+    return;
+
+  // Let the servo reach its position and the publish leave the socket
+  while ((long)(millis() - awakeUntilTime) < 0)
+  {
+    mqtt.update();
+    delay(10);
+  }
+  publishMetrics();
+  mqtt.update();
+  mqtt.disconnect();
+
+  quietSleepMs = 0;
+  armTiltWakeup();
+  enterDeepSleep(cycleInterval());
+}
+
+/**
+ * Critical profile, woken by the timer: samples without WiFi and goes straight back to sleep,
+ * unless the lid has to move, the battery has recovered, or the heartbeat is due. Returns to continue a full boot.
+ */
+void runQuietWake()
+{
+  if (!isAlertOnly() || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER)
+    return;
+
+  quietSleepMs += cycleInterval();
+  if (quietSleepMs >= CRITICAL_HEARTBEAT_MS)
+  {
+    Serial.println("[POWER] Heartbeat due, full wake-up.");
+    return;
+  }
+
+  std::vector<float> readings;
+  for (int i = 0; i < TARGET_SAMPLES; i++)
+  {
+    float val = distanceSensor.measureDistanceCm();
+    if (val > MIN_VALID_CM && val <= binGeometry.getMaxRangeCm())
+    {
+      readings.push_back(val);
+    }
+    delay(SAMPLE_INTERVAL);
+  }
+
+  float distance = processReadings(readings);
+  if (distance > 0)
+  {
+    int fillPercentage = (int)lroundf(binGeometry.toFillPercent(distance));
+    bool isCrossing = isBinClosed ? fillPercentage < (threshold - THRESHOLD_DEADZONE) : fillPercentage > threshold;
+    if (isCrossing)
+    {
+      Serial.printf("[POWER] Quiet wake: fill %d%% crossed the threshold, full wake-up.\n", fillPercentage);
+      return;
+    }
+    Serial.printf("[POWER] Quiet wake: fill %d%%, back to sleep.\n", fillPercentage);
+  }
+
+  armTiltWakeup();
+  enterDeepSleep(cycleInterval());
+}
+
 void loop()
 {
-  if (WiFi.status() != WL_CONNECTED)
+  // While on a fallback (LoRaWAN or ESP-NOW relay), WiFi is only retried every WIFI_RETRY_INTERVAL_MS
+  bool canRetryWifi = !isOnFallback || millis() - lastWifiAttemptTime >= WIFI_RETRY_INTERVAL_MS;
+  if (WiFi.status() != WL_CONNECTED && canRetryWifi)
   {
     Serial.println("WiFi disconnected. Reconnecting...");
     connectToWifi();
   }
 
-  if (!mqtt.isConnected())
+  if (WiFi.status() == WL_CONNECTED && !mqtt.isConnected())
   {
     Serial.println("MQTT disconnected. Reconnecting...");
+    markConnectStart();
     connectToMqtt();
   }
 
   mqtt.update();
+  serviceTimeSync();
+
+  // Don't hold 240 MHz while there is no network to connect to (e.g. on the LoRaWAN fallback)
+  requestMaxCpu(isTimingConnect && WiFi.status() == WL_CONNECTED);
+
+  // No retained config arrived after subscribing, ask the server for it
+  if (isConfigPending && !isConfigRequested && mqtt.isConnected() && (long)(millis() - configRequestDeadline) >= 0)
+  {
+    isConfigRequested = true;
+    requestThreshold();
+  }
+
+#if defined(LORAWAN_FALLBACK_ENABLED)
+  os_runloop_once();
+  loraUplink.service(millis());
+#endif
+
+#if defined(MESH_RELAY_ENABLED)
+  serviceMesh(millis());
+#endif
+
+  serviceSummary(millis());
 
   unsigned long now = millis();
 
@@ -441,7 +2024,16 @@ void loop()
       {
         Serial.println("[TILT] Bin tilted (Confirmed)! Pausing sampling.");
         wasTilted = true;
-        isSampling = false;
+        if (isSampling)
+        {
+          endBurst();
+        }
+        if (isCalibrating)
+        {
+          // Measure again once the bin is upright
+          isCalibrating = false;
+          isCalibrationPending = true;
+        }
 
         float voltage = readBatteryVoltage();
         int batteryLevel = getBatteryPercentage(voltage);
@@ -453,11 +2045,13 @@ void loop()
         doc["voltage"] = round(voltage * 100.0) / 100.0;
         doc["isTilted"] = true;
 
-        char output[256];
-        serializeJson(doc, output);
-        mqtt.publish(MQTT::Topics::getData(DEVICE_ID), output);
-        Serial.print("Published Tilt Alert: ");
-        Serial.println(output);
+        Serial.println("Publishing Tilt Alert...");
+        publishReading(doc);
+
+        if (isAlertOnly())
+        {
+          sleepUntilNextCycle();
+        }
       }
 
       // While effectively tilted, we reset the loop to avoid sampling
@@ -475,54 +2069,87 @@ void loop()
   {
     Serial.println("[TILT] Bin upright. Triggering fast recovery sample in 2s.");
     wasTilted = false;
-    lastCycleTime = now - CYCLE_INTERVAL + (2 * 1000);
+    // The bin was most likely emptied, so the previous cycles are no longer a valid reference
+    cycleFilter.reset();
+    isRecoveryPending = true;
+    recoverySampleTime = now + (2 * 1000);
+    // The fill level most likely dropped, report it right away
+    isImmediatePublishPending = true;
   }
 
   // --- SAMPLING LOGIC ---
-  if (!isSampling && (now - lastCycleTime > CYCLE_INTERVAL))
+  // Signed differences keep the comparisons valid across millis() wrap-around
+  if (!isSampling && (long)(now - nextSlotTime) >= 0)
+  {
+    triggerSampling();
+  }
+  // Skip any slots missed while tilted or busy, without shifting the grid
+  while ((long)(now - nextSlotTime) >= 0)
+  {
+    nextSlotTime += cycleInterval();
+  }
+
+  if (isRecoveryPending && !isSampling && (long)(now - recoverySampleTime) >= 0)
   {
+    isRecoveryPending = false;
     triggerSampling();
   }
+  if (isCalibrationPending && !isSampling)
+  {
+    startCalibration();
+  }
+  serviceRemoteTrigger(now);
 
   if (isSampling)
   {
-    if (now - lastSampleTime >= SAMPLE_INTERVAL)
+    if (isPingDue)
     {
-      lastSampleTime = now;
+      isPingDue = false;
 
+      int64_t pingStartUs = esp_timer_get_time();
       float val = distanceSensor.measureDistanceCm();
-      if (val > MIN_VALID_CM && val <= BIN_HEIGHT_CM)
+      burstPingUs += esp_timer_get_time() - pingStartUs;
+      float maxValidCm = isCalibrating ? MAX_DISTANCE_CM : binGeometry.getMaxRangeCm();
+      if (val > MIN_VALID_CM && val <= maxValidCm)
       {
         currentReadings.push_back(val);
       }
 
-      static int attempts = 0;
-      attempts++;
+      burstPingCount++;
 
-      if (attempts >= TARGET_SAMPLES)
+      if (burstPingCount >= TARGET_SAMPLES)
       {
-        isSampling = false;
-        attempts = 0;
+        endBurst();
 
         Serial.printf("Collected %d valid samples.\n", currentReadings.size());
         float distance = processReadings(currentReadings);
 
-        if (distance > 0)
+        if (isCalibrating)
+        {
+          finishCalibration(distance, currentReadings.size());
+        }
+        else if (distance > 0)
         {
-          int fillPercentage = map((long)distance, 0, (long)BIN_HEIGHT_CM, 100, 0);
-          fillPercentage = constrain(fillPercentage, 0, 100);
+          distance = cycleFilter.update(distance);
+          bool isOutlier = cycleFilter.wasRejected();
+          if (isOutlier)
+          {
+            Serial.printf("[FILTER] Cycle rejected as outlier, using median %.1fcm (Total rejected: %u)\n", distance, cycleFilter.getRejectedCount());
+          }
+
+          int fillPercentage = (int)lroundf(binGeometry.toFillPercent(distance));
           lastValidFillLevel = fillPercentage;
 
           Serial.printf("Fill: %d%% | Threshold: %d%%\n", fillPercentage, threshold);
 
           // --- ACTUATION LOGIC ---
-          const int DEADZONE = 1; // 11 buffer
+          bool wasBinClosed = isBinClosed;
 
           if (fillPercentage > threshold)
           {
             closeBin();
           }
-          else if (fillPercentage < (threshold - DEADZONE))
+          else if (fillPercentage < (threshold - THRESHOLD_DEADZONE))
           {
             openBin();
           }
@@ -530,27 +2157,67 @@ void loop()
           float voltage = readBatteryVoltage();
           int batteryLevel = getBatteryPercentage(voltage);
           bool isTilted = false; // We know it's false because we skip loop if true
+          updatePowerProfile(batteryLevel);
 
-          JsonDocument doc;
-          doc["deviceId"] = DEVICE_ID;
-          doc["fillLevel"] = fillPercentage;
-          doc["batteryPercentage"] = batteryLevel;
-          doc["voltage"] = round(voltage * 100.0) / 100.0; // Round to 2 decimals
-          doc["isTilted"] = isTilted;
-
-          char output[256];
-          serializeJson(doc, output);
-          mqtt.publish(MQTT::Topics::getData(DEVICE_ID), output);
-          Serial.print("Published: ");
-          Serial.println(output);
+          aggregator.add(millis(), fillPercentage, batteryLevel);
+
+          bool isThresholdCrossing = isBinClosed != wasBinClosed;
+          bool isRemoteRequest = burstTriggerCount > 0;
+          if (USE_AGGREGATION && !isThresholdCrossing && !isRemoteRequest && !isImmediatePublishPending)
+          {
+            Serial.printf("Aggregated reading (%u this period).\n", aggregator.getCount());
+          }
+          else
+          {
+            isImmediatePublishPending = false;
+
+            JsonDocument doc;
+            doc["deviceId"] = DEVICE_ID;
+            doc["fillLevel"] = fillPercentage;
+            doc["batteryPercentage"] = batteryLevel;
+            doc["voltage"] = round(voltage * 100.0) / 100.0; // Round to 2 decimals
+            doc["isTilted"] = isTilted;
+            doc["isOutlier"] = isOutlier;
+            doc["outlierCount"] = cycleFilter.getRejectedCount();
+            attachTimestamp(doc);
+            attachRequestIds(doc);
+
+            publishReading(doc);
+          }
         }
         else
         {
           Serial.println("Error: No valid readings.");
         }
+
+        if (isAlertOnly())
+        {
+          sleepUntilNextCycle();
+        }
       }
     }
   }
 
-  delay(10); // Needed to trigger Modem Sleep
+  serviceAwakeLock(millis());
+#if defined(MESH_RELAY_ENABLED)
+  // The radio keeps receiving for ESP-NOW on the fallback too
+  powerAccounting.set(POWER_RADIO_CONNECTED, WiFi.status() == WL_CONNECTED || isOnFallback, esp_timer_get_time());
+#else
+  powerAccounting.set(POWER_RADIO_CONNECTED, WiFi.status() == WL_CONNECTED, esp_timer_get_time());
+#endif
+  serviceMetrics(millis());
+
+  // Block until the next ping is due or 10ms pass. While every task is blocked the chip
+  // light-sleeps (power management on) or at least lets the idle task trigger Modem Sleep.
+  int64_t idleStartUs = esp_timer_get_time();
+  ulTaskNotifyTake(pdTRUE, LOOP_IDLE_TICKS);
+  int64_t idleUs = esp_timer_get_time() - idleStartUs;
+  if (isSampling)
+  {
+    burstIdleUs += idleUs;
+  }
+  if (isLightSleepEnabled)
+  {
+    powerAccounting.add(POWER_LIGHT_SLEEP, idleUs);
+  }
 }
\ No newline at end of file
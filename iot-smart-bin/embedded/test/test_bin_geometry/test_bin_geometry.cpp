@@ -0,0 +1,139 @@
+#include <unity.h>
+#include "BinGeometry.h"
+
+// A tapered bin: the narrow bottom holds little volume, so fill percent drops fast near the floor
+static const VolumePoint TAPERED[] = {
+    {80, 0},
+    {10, 100},
+    {40, 50},
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_linear_mapping()
+{
+    BinGeometry geometry(100);
+    TEST_ASSERT_EQUAL_FLOAT(100, geometry.toFillPercent(0));
+    TEST_ASSERT_EQUAL_FLOAT(75, geometry.toFillPercent(25));
+    TEST_ASSERT_EQUAL_FLOAT(0, geometry.toFillPercent(100));
+
+    // Echoes past the floor or inside the sensor's dead zone are clamped
+    TEST_ASSERT_EQUAL_FLOAT(0, geometry.toFillPercent(120));
+    TEST_ASSERT_EQUAL_FLOAT(100, geometry.toFillPercent(-5));
+}
+
+void test_uncalibrated_bin_reads_empty()
+{
+    BinGeometry geometry(0);
+    TEST_ASSERT_EQUAL_FLOAT(0, geometry.toFillPercent(30));
+}
+
+void test_echo_timeout_follows_empty_distance()
+{
+    BinGeometry geometry(80, 0.25f);
+    TEST_ASSERT_EQUAL_UINT16(100, geometry.getMaxRangeCm());
+    // 2.5 * 100 cm / 0.0343 cm/us
+    TEST_ASSERT_EQUAL_UINT32(7288, geometry.getEchoTimeoutUs());
+
+    geometry.setEmptyDistanceCm(160);
+    TEST_ASSERT_EQUAL_FLOAT(160, geometry.getEmptyDistanceCm());
+    TEST_ASSERT_EQUAL_UINT16(200, geometry.getMaxRangeCm());
+    TEST_ASSERT_EQUAL_UINT32(14577, geometry.getEchoTimeoutUs());
+}
+
+void test_table_deeper_than_floor_extends_range()
+{
+    BinGeometry geometry(60, 0.25f);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(TAPERED, 3));
+    TEST_ASSERT_EQUAL_UINT16(80, geometry.getMaxRangeCm());
+}
+
+void test_table_is_sorted_and_interpolated()
+{
+    BinGeometry geometry(80);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(TAPERED, 3));
+    TEST_ASSERT_EQUAL_UINT8(3, geometry.getVolumeTableSize());
+    TEST_ASSERT_EQUAL_FLOAT(10, geometry.getVolumeTable()[0].distanceCm);
+    TEST_ASSERT_EQUAL_FLOAT(80, geometry.getVolumeTable()[2].distanceCm);
+
+    TEST_ASSERT_EQUAL_FLOAT(100, geometry.toFillPercent(10));
+    TEST_ASSERT_EQUAL_FLOAT(75, geometry.toFillPercent(25));
+    TEST_ASSERT_EQUAL_FLOAT(50, geometry.toFillPercent(40));
+    TEST_ASSERT_EQUAL_FLOAT(25, geometry.toFillPercent(60));
+
+    // Clamped to the end points, not extrapolated
+    TEST_ASSERT_EQUAL_FLOAT(100, geometry.toFillPercent(2));
+    TEST_ASSERT_EQUAL_FLOAT(0, geometry.toFillPercent(95));
+}
+
+void test_table_drops_duplicate_distances()
+{
+    const VolumePoint points[] = {{10, 100}, {40, 50}, {40, 60}, {80, 0}};
+    BinGeometry geometry(80);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(points, 4));
+    TEST_ASSERT_EQUAL_UINT8(3, geometry.getVolumeTableSize());
+    TEST_ASSERT_EQUAL_FLOAT(50, geometry.toFillPercent(40));
+    TEST_ASSERT_EQUAL_FLOAT(0, geometry.getVolumeTable()[2].fillPercent);
+}
+
+void test_table_keeps_at_most_max_points()
+{
+    VolumePoint points[BinGeometry::MAX_POINTS + 4];
+    for (uint8_t i = 0; i < BinGeometry::MAX_POINTS + 4; i++)
+    {
+        points[i] = {10.0f + i, 100.0f - i};
+    }
+    BinGeometry geometry(80);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(points, BinGeometry::MAX_POINTS + 4));
+    TEST_ASSERT_EQUAL_UINT8(BinGeometry::MAX_POINTS, geometry.getVolumeTableSize());
+}
+
+void test_invalid_tables_are_rejected()
+{
+    BinGeometry geometry(80);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(TAPERED, 3));
+
+    const VolumePoint single[] = {{10, 100}};
+    TEST_ASSERT_FALSE(geometry.setVolumeTable(single, 1));
+
+    const VolumePoint sameDistance[] = {{40, 50}, {40, 60}};
+    TEST_ASSERT_FALSE(geometry.setVolumeTable(sameDistance, 2));
+
+    // Farther from the sensor can't be fuller
+    const VolumePoint rising[] = {{10, 100}, {40, 30}, {60, 40}};
+    TEST_ASSERT_FALSE(geometry.setVolumeTable(rising, 3));
+
+    // A rejected table leaves the previous one in place
+    TEST_ASSERT_EQUAL_UINT8(3, geometry.getVolumeTableSize());
+    TEST_ASSERT_EQUAL_FLOAT(75, geometry.toFillPercent(25));
+}
+
+void test_empty_table_restores_linear_mapping()
+{
+    BinGeometry geometry(100);
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(TAPERED, 3));
+    TEST_ASSERT_TRUE(geometry.setVolumeTable(nullptr, 0));
+    TEST_ASSERT_EQUAL_UINT8(0, geometry.getVolumeTableSize());
+    TEST_ASSERT_EQUAL_FLOAT(50, geometry.toFillPercent(50));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_linear_mapping);
+    RUN_TEST(test_uncalibrated_bin_reads_empty);
+    RUN_TEST(test_echo_timeout_follows_empty_distance);
+    RUN_TEST(test_table_deeper_than_floor_extends_range);
+    RUN_TEST(test_table_is_sorted_and_interpolated);
+    RUN_TEST(test_table_drops_duplicate_distances);
+    RUN_TEST(test_table_keeps_at_most_max_points);
+    RUN_TEST(test_invalid_tables_are_rejected);
+    RUN_TEST(test_empty_table_restores_linear_mapping);
+    return UNITY_END();
+}
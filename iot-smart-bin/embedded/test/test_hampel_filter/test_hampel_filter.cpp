@@ -0,0 +1,138 @@
+#include <unity.h>
+#include "HampelFilter.h"
+
+// Ultrasonic jitter on a steady reading, below this nothing is an outlier
+static const float MIN_DEVIATION = 2.0f;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void fill(HampelFilter &filter, float value, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        filter.update(value);
+    }
+}
+
+void test_accepts_everything_until_three_values()
+{
+    HampelFilter filter(5, 3.0f, MIN_DEVIATION);
+    TEST_ASSERT_EQUAL_FLOAT(10, filter.update(10));
+    TEST_ASSERT_EQUAL_FLOAT(10, filter.update(10));
+    TEST_ASSERT_EQUAL_FLOAT(100, filter.update(100));
+    TEST_ASSERT_FALSE(filter.wasRejected());
+    TEST_ASSERT_EQUAL_UINT32(0, filter.getRejectedCount());
+}
+
+void test_spike_is_replaced_by_median()
+{
+    HampelFilter filter(5, 3.0f, MIN_DEVIATION);
+    filter.update(50);
+    filter.update(51);
+    filter.update(50);
+    filter.update(49);
+    filter.update(50);
+
+    TEST_ASSERT_EQUAL_FLOAT(50, filter.update(200));
+    TEST_ASSERT_TRUE(filter.wasRejected());
+    TEST_ASSERT_EQUAL_UINT32(1, filter.getRejectedCount());
+
+    // The flag only describes the last value
+    TEST_ASSERT_EQUAL_FLOAT(51, filter.update(51));
+    TEST_ASSERT_FALSE(filter.wasRejected());
+}
+
+void test_min_deviation_keeps_jitter_on_steady_window()
+{
+    // MAD is 0 on a perfectly steady window, so without the floor any change is rejected
+    HampelFilter strict(5, 3.0f, 0.0f);
+    fill(strict, 50, 5);
+    TEST_ASSERT_EQUAL_FLOAT(50, strict.update(51));
+    TEST_ASSERT_TRUE(strict.wasRejected());
+
+    HampelFilter tolerant(5, 3.0f, MIN_DEVIATION);
+    fill(tolerant, 50, 5);
+    TEST_ASSERT_EQUAL_FLOAT(51, tolerant.update(51));
+    TEST_ASSERT_FALSE(tolerant.wasRejected());
+}
+
+void test_even_window_uses_mean_of_middle_values()
+{
+    // Median 25, MAD 10, bound 3 * 1.4826 * 10 = 44.5
+    HampelFilter filter(4, 3.0f, 0.0f);
+    filter.update(10);
+    filter.update(20);
+    filter.update(30);
+    filter.update(40);
+    TEST_ASSERT_EQUAL_FLOAT(25, filter.update(80));
+    TEST_ASSERT_TRUE(filter.wasRejected());
+}
+
+void test_lasting_step_is_accepted_once_it_fills_half_the_window()
+{
+    HampelFilter filter(5, 3.0f, MIN_DEVIATION);
+    fill(filter, 50, 5);
+
+    // The bin was emptied: the first three new distances still lose against the old median
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        TEST_ASSERT_EQUAL_FLOAT(50, filter.update(80));
+        TEST_ASSERT_TRUE(filter.wasRejected());
+    }
+    TEST_ASSERT_EQUAL_FLOAT(80, filter.update(80));
+    TEST_ASSERT_FALSE(filter.wasRejected());
+    TEST_ASSERT_EQUAL_UINT32(3, filter.getRejectedCount());
+}
+
+void test_reset_forgets_window_but_keeps_count()
+{
+    HampelFilter filter(5, 3.0f, MIN_DEVIATION);
+    fill(filter, 50, 5);
+    filter.update(200);
+    TEST_ASSERT_TRUE(filter.wasRejected());
+
+    filter.reset();
+    TEST_ASSERT_FALSE(filter.wasRejected());
+    TEST_ASSERT_EQUAL_FLOAT(80, filter.update(80));
+    TEST_ASSERT_FALSE(filter.wasRejected());
+    TEST_ASSERT_EQUAL_UINT32(1, filter.getRejectedCount());
+}
+
+void test_window_size_is_clamped()
+{
+    // Clamped up to 3: a step needs two values in the window to win
+    HampelFilter small(1, 3.0f, MIN_DEVIATION);
+    fill(small, 50, 3);
+    TEST_ASSERT_EQUAL_FLOAT(50, small.update(80));
+    TEST_ASSERT_EQUAL_FLOAT(50, small.update(80));
+    TEST_ASSERT_EQUAL_FLOAT(80, small.update(80));
+
+    // Clamped down to MAX_WINDOW: a step wins after MAX_WINDOW / 2 + 1 values
+    HampelFilter large(255, 3.0f, MIN_DEVIATION);
+    fill(large, 50, HampelFilter::MAX_WINDOW);
+    for (uint8_t i = 0; i < HampelFilter::MAX_WINDOW / 2 + 1; i++)
+    {
+        large.update(80);
+    }
+    TEST_ASSERT_EQUAL_UINT32(HampelFilter::MAX_WINDOW / 2 + 1, large.getRejectedCount());
+    TEST_ASSERT_EQUAL_FLOAT(80, large.update(80));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_accepts_everything_until_three_values);
+    RUN_TEST(test_spike_is_replaced_by_median);
+    RUN_TEST(test_min_deviation_keeps_jitter_on_steady_window);
+    RUN_TEST(test_even_window_uses_mean_of_middle_values);
+    RUN_TEST(test_lasting_step_is_accepted_once_it_fills_half_the_window);
+    RUN_TEST(test_reset_forgets_window_but_keeps_count);
+    RUN_TEST(test_window_size_is_clamped);
+    return UNITY_END();
+}
@@ -0,0 +1,219 @@
+#include <unity.h>
+#include <string.h>
+#include "LoRaUplink.h"
+
+/**
+ * Records what the uplink hands to the radio. Busy and refusing radios are set per test.
+ */
+class FakeRadio : public LoRaRadio
+{
+public:
+    bool busy = false;
+    bool accept = true;
+    uint32_t sendCount = 0;
+    uint8_t lastPort = 0;
+    uint8_t lastData[16];
+    uint8_t lastLength = 0;
+
+    bool isBusy() override
+    {
+        return busy;
+    }
+
+    bool send(uint8_t port, const uint8_t *data, uint8_t length) override
+    {
+        if (!accept)
+            return false;
+        sendCount++;
+        lastPort = port;
+        lastLength = length;
+        memcpy(lastData, data, length);
+        return true;
+    }
+};
+
+static const uint8_t SF = 10;
+static uint32_t airtimeMs;
+static uint32_t dutyCycleGapMs;
+
+void setUp()
+{
+    airtimeMs = loraAirtimeMs(SF, 125000, BIN_READING_PACKED_SIZE + LORAWAN_OVERHEAD_BYTES);
+    dutyCycleGapMs = (uint32_t)(airtimeMs / 0.01f);
+}
+
+void tearDown()
+{
+}
+
+static BinReading reading(uint8_t fill, uint8_t battery, bool tilted)
+{
+    BinReading r;
+    r.fillLevel = fill;
+    r.batteryPercentage = battery;
+    r.isTilted = tilted;
+    return r;
+}
+
+void test_pack_round_trip()
+{
+    uint8_t buffer[BIN_READING_PACKED_SIZE];
+    packBinReading(reading(73, 41, true), buffer);
+    TEST_ASSERT_EQUAL_UINT8(0x80 | 73, buffer[0]);
+    TEST_ASSERT_EQUAL_UINT8(41, buffer[1]);
+
+    BinReading decoded;
+    TEST_ASSERT_TRUE(unpackBinReading(buffer, sizeof(buffer), decoded));
+    TEST_ASSERT_EQUAL_UINT8(73, decoded.fillLevel);
+    TEST_ASSERT_EQUAL_UINT8(41, decoded.batteryPercentage);
+    TEST_ASSERT_TRUE(decoded.isTilted);
+}
+
+void test_pack_clamps_to_100()
+{
+    uint8_t buffer[BIN_READING_PACKED_SIZE];
+    packBinReading(reading(180, 255, false), buffer);
+
+    BinReading decoded;
+    TEST_ASSERT_TRUE(unpackBinReading(buffer, sizeof(buffer), decoded));
+    TEST_ASSERT_EQUAL_UINT8(100, decoded.fillLevel);
+    TEST_ASSERT_EQUAL_UINT8(100, decoded.batteryPercentage);
+    TEST_ASSERT_FALSE(decoded.isTilted);
+}
+
+void test_unpack_rejects_short_or_out_of_range()
+{
+    uint8_t buffer[BIN_READING_PACKED_SIZE] = {50, 50};
+    BinReading decoded;
+    TEST_ASSERT_FALSE(unpackBinReading(buffer, 1, decoded));
+
+    buffer[0] = 101;
+    TEST_ASSERT_FALSE(unpackBinReading(buffer, sizeof(buffer), decoded));
+}
+
+void test_airtime_matches_reference()
+{
+    // Semtech LoRa calculator, 2-byte payload + LoRaWAN overhead at 125 kHz
+    TEST_ASSERT_EQUAL_UINT32(47, loraAirtimeMs(7, 125000, 15));
+    TEST_ASSERT_EQUAL_UINT32(1156, loraAirtimeMs(12, 125000, 15));
+}
+
+void test_service_sends_packed_reading()
+{
+    FakeRadio radio;
+    LoRaUplink uplink(radio, SF);
+    TEST_ASSERT_FALSE(uplink.service(0));
+
+    uplink.queue(reading(60, 90, false));
+    TEST_ASSERT_TRUE(uplink.service(1000));
+    TEST_ASSERT_FALSE(uplink.hasPending());
+    TEST_ASSERT_EQUAL_UINT8(LoRaUplink::PORT, radio.lastPort);
+    TEST_ASSERT_EQUAL_UINT8(BIN_READING_PACKED_SIZE, radio.lastLength);
+    TEST_ASSERT_EQUAL_UINT8(60, radio.lastData[0]);
+    TEST_ASSERT_EQUAL_UINT8(90, radio.lastData[1]);
+    TEST_ASSERT_EQUAL_UINT32(1, uplink.getSentCount());
+    TEST_ASSERT_EQUAL_UINT32(airtimeMs, uplink.getAirtimeUsedTodayMs());
+}
+
+void test_busy_or_refusing_radio_keeps_reading()
+{
+    FakeRadio radio;
+    LoRaUplink uplink(radio, SF);
+    uplink.queue(reading(10, 90, false));
+
+    radio.busy = true;
+    TEST_ASSERT_FALSE(uplink.service(0));
+    radio.busy = false;
+    radio.accept = false;
+    TEST_ASSERT_FALSE(uplink.service(0));
+    TEST_ASSERT_TRUE(uplink.hasPending());
+
+    radio.accept = true;
+    TEST_ASSERT_TRUE(uplink.service(0));
+    TEST_ASSERT_EQUAL_UINT32(1, radio.sendCount);
+}
+
+void test_duty_cycle_gates_next_send()
+{
+    FakeRadio radio;
+    LoRaUplink uplink(radio, SF, 0.01f);
+    uplink.queue(reading(10, 90, false));
+    TEST_ASSERT_TRUE(uplink.service(0));
+
+    uplink.queue(reading(11, 90, false));
+    TEST_ASSERT_FALSE(uplink.service(1));
+    TEST_ASSERT_FALSE(uplink.service(dutyCycleGapMs - 1));
+    TEST_ASSERT_TRUE(uplink.hasPending());
+    TEST_ASSERT_TRUE(uplink.service(dutyCycleGapMs));
+    TEST_ASSERT_EQUAL_UINT32(2, radio.sendCount);
+}
+
+void test_duty_cycle_survives_millis_wrap()
+{
+    FakeRadio radio;
+    LoRaUplink uplink(radio, SF, 0.01f);
+    uint32_t start = UINT32_MAX - 1000;
+    uplink.queue(reading(10, 90, false));
+    TEST_ASSERT_TRUE(uplink.service(start));
+
+    uplink.queue(reading(11, 90, false));
+    TEST_ASSERT_FALSE(uplink.service(start + 2000)); // Wrapped, still inside the gap
+    TEST_ASSERT_TRUE(uplink.service(start + dutyCycleGapMs));
+}
+
+void test_daily_budget_blocks_until_next_day()
+{
+    FakeRadio radio;
+    // Room for exactly two uplinks a day, and no duty cycle limit in practice
+    LoRaUplink uplink(radio, SF, 1.0f, 2 * airtimeMs);
+
+    uint32_t now = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        uplink.queue(reading(10, 90, false));
+        TEST_ASSERT_TRUE(uplink.service(now));
+        now += airtimeMs;
+    }
+
+    uplink.queue(reading(12, 90, false));
+    TEST_ASSERT_FALSE(uplink.service(now));
+    TEST_ASSERT_FALSE(uplink.service(LoRaUplink::DAY_MS - 1));
+    TEST_ASSERT_TRUE(uplink.service(LoRaUplink::DAY_MS));
+    TEST_ASSERT_EQUAL_UINT32(airtimeMs, uplink.getAirtimeUsedTodayMs());
+}
+
+void test_queue_replaces_pending_reading()
+{
+    FakeRadio radio;
+    LoRaUplink uplink(radio, SF);
+    uplink.queue(reading(20, 90, false));
+    uplink.queue(reading(30, 90, false));
+    uplink.queue(reading(40, 80, true));
+    TEST_ASSERT_EQUAL_UINT32(2, uplink.getDroppedCount());
+
+    // Only the latest reading goes out
+    TEST_ASSERT_TRUE(uplink.service(0));
+    TEST_ASSERT_EQUAL_UINT32(1, radio.sendCount);
+    TEST_ASSERT_EQUAL_UINT8(0x80 | 40, radio.lastData[0]);
+    TEST_ASSERT_EQUAL_UINT8(80, radio.lastData[1]);
+
+    // Nothing pending after the send, so the next queue drops nothing
+    uplink.queue(reading(50, 80, false));
+    TEST_ASSERT_EQUAL_UINT32(2, uplink.getDroppedCount());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_pack_round_trip);
+    RUN_TEST(test_pack_clamps_to_100);
+    RUN_TEST(test_unpack_rejects_short_or_out_of_range);
+    RUN_TEST(test_airtime_matches_reference);
+    RUN_TEST(test_service_sends_packed_reading);
+    RUN_TEST(test_busy_or_refusing_radio_keeps_reading);
+    RUN_TEST(test_duty_cycle_gates_next_send);
+    RUN_TEST(test_duty_cycle_survives_millis_wrap);
+    RUN_TEST(test_daily_budget_blocks_until_next_day);
+    RUN_TEST(test_queue_replaces_pending_reading);
+    return UNITY_END();
+}
@@ -0,0 +1,361 @@
+#include <unity.h>
+#include <string.h>
+#include <vector>
+#include "MeshRelay.h"
+
+/**
+ * Captures the frames a node sends. Tests deliver (or drop) them by hand.
+ */
+class FakeLink : public MeshLink
+{
+public:
+    struct Frame
+    {
+        bool isBroadcast;
+        uint8_t mac[MESH_MAC_LENGTH];
+        uint8_t data[MESH_MAX_FRAME_SIZE];
+        uint8_t length;
+    };
+
+    std::vector<Frame> sent;
+
+    bool send(const uint8_t *mac, const uint8_t *data, uint8_t length) override
+    {
+        Frame frame;
+        frame.isBroadcast = mac == nullptr;
+        memset(frame.mac, 0, sizeof(frame.mac));
+        if (mac != nullptr)
+            memcpy(frame.mac, mac, MESH_MAC_LENGTH);
+        memcpy(frame.data, data, length);
+        frame.length = length;
+        sent.push_back(frame);
+        return true;
+    }
+
+    Frame take()
+    {
+        TEST_ASSERT_FALSE(sent.empty());
+        Frame frame = sent.front();
+        sent.erase(sent.begin());
+        return frame;
+    }
+};
+
+static const uint8_t RELAY_MAC[MESH_MAC_LENGTH] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+static const uint8_t ORIGIN_MAC[MESH_MAC_LENGTH] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x02};
+
+static const uint32_t RETRY_MS = 500;
+static const uint32_t RELAY_TIMEOUT_MS = 30000;
+static const uint8_t MAX_RETRIES = 3;
+static const char *const ALLOWED_ORIGINS[] = {"BIN_ORIGIN", "BIN-002"};
+
+static FakeLink *relayLink;
+static FakeLink *originLink;
+static MeshRelay *relay;
+static MeshRelay *origin;
+
+void setUp()
+{
+    relayLink = new FakeLink();
+    originLink = new FakeLink();
+    relay = new MeshRelay(*relayLink, "BIN_RELAY", 5000, RELAY_TIMEOUT_MS, RETRY_MS, MAX_RETRIES);
+    origin = new MeshRelay(*originLink, "BIN_ORIGIN", 5000, RELAY_TIMEOUT_MS, RETRY_MS, MAX_RETRIES);
+    relay->setAllowedOrigins(ALLOWED_ORIGINS, 2);
+}
+
+void tearDown()
+{
+    delete origin;
+    delete relay;
+    delete originLink;
+    delete relayLink;
+}
+
+static MeshReading meshReading(uint8_t fill)
+{
+    MeshReading reading;
+    reading.reading.fillLevel = fill;
+    reading.reading.batteryPercentage = 70;
+    reading.reading.isTilted = false;
+    reading.voltageMv = 3850;
+    return reading;
+}
+
+static void deliverToRelay(const FakeLink::Frame &frame, uint32_t nowMs)
+{
+    relay->onReceive(ORIGIN_MAC, frame.data, frame.length, nowMs);
+}
+
+static void deliverToOrigin(const FakeLink::Frame &frame, uint32_t nowMs)
+{
+    origin->onReceive(RELAY_MAC, frame.data, frame.length, nowMs);
+}
+
+/**
+ * Relay announces itself and the origin picks it up.
+ */
+static void connect(uint32_t nowMs)
+{
+    relay->setUplink(true);
+    relay->service(nowMs);
+    FakeLink::Frame beacon = relayLink->take();
+    TEST_ASSERT_TRUE(beacon.isBroadcast);
+    TEST_ASSERT_EQUAL_UINT8(MESH_BEACON, beacon.data[1]);
+    deliverToOrigin(beacon, nowMs);
+    TEST_ASSERT_TRUE(origin->hasRelay(nowMs));
+}
+
+void test_reading_is_relayed_and_acknowledged()
+{
+    connect(0);
+    origin->queue(meshReading(42));
+    origin->service(10);
+
+    FakeLink::Frame frame = originLink->take();
+    TEST_ASSERT_EQUAL_UINT8(MESH_READING, frame.data[1]);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(RELAY_MAC, frame.mac, MESH_MAC_LENGTH);
+    deliverToRelay(frame, 20);
+
+    FakeLink::Frame ack = relayLink->take();
+    TEST_ASSERT_EQUAL_UINT8(MESH_ACK, ack.data[1]);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(ORIGIN_MAC, ack.mac, MESH_MAC_LENGTH);
+    deliverToOrigin(ack, 30);
+    TEST_ASSERT_FALSE(origin->hasPending());
+    TEST_ASSERT_EQUAL_UINT32(1, origin->getSentCount());
+
+    RelayedReading relayed;
+    TEST_ASSERT_TRUE(relay->popRelayed(relayed));
+    TEST_ASSERT_EQUAL_STRING("BIN_ORIGIN", relayed.originId);
+    TEST_ASSERT_EQUAL_UINT8(42, relayed.data.reading.fillLevel);
+    TEST_ASSERT_EQUAL_UINT16(3850, relayed.data.voltageMv);
+    TEST_ASSERT_FALSE(relay->popRelayed(relayed));
+}
+
+void test_dropped_ack_is_resent_and_deduplicated()
+{
+    connect(0);
+    origin->queue(meshReading(55));
+    origin->service(10);
+    deliverToRelay(originLink->take(), 20);
+    relayLink->take(); // ACK lost
+
+    // No resend before the retry interval
+    origin->service(10 + RETRY_MS - 1);
+    TEST_ASSERT_TRUE(originLink->sent.empty());
+
+    origin->service(10 + RETRY_MS);
+    FakeLink::Frame resend = originLink->take();
+    TEST_ASSERT_EQUAL_UINT8(MESH_READING, resend.data[1]);
+    deliverToRelay(resend, 10 + RETRY_MS + 10);
+
+    // Acknowledged again, but queued only once
+    FakeLink::Frame ack = relayLink->take();
+    TEST_ASSERT_EQUAL_UINT8(MESH_ACK, ack.data[1]);
+    TEST_ASSERT_EQUAL_UINT32(1, relay->getRelayedCount());
+    deliverToOrigin(ack, 10 + RETRY_MS + 20);
+    TEST_ASSERT_FALSE(origin->hasPending());
+
+    RelayedReading relayed;
+    TEST_ASSERT_TRUE(relay->popRelayed(relayed));
+    TEST_ASSERT_FALSE(relay->popRelayed(relayed));
+}
+
+void test_relay_is_forgotten_after_max_retries()
+{
+    connect(0);
+    origin->queue(meshReading(60));
+
+    uint32_t now = 10;
+    for (uint8_t i = 0; i < MAX_RETRIES; i++)
+    {
+        origin->service(now);
+        TEST_ASSERT_EQUAL_UINT8(MESH_READING, originLink->take().data[1]);
+        now += RETRY_MS;
+    }
+
+    // Unanswered: the relay is dropped, nothing more is sent, and the reading is kept for the next relay
+    origin->service(now);
+    TEST_ASSERT_TRUE(originLink->sent.empty());
+    TEST_ASSERT_FALSE(origin->hasRelay(now));
+    TEST_ASSERT_TRUE(origin->hasPending());
+    origin->service(now + RETRY_MS);
+    TEST_ASSERT_TRUE(originLink->sent.empty());
+
+    // A new beacon brings it back
+    relay->service(now + 5000);
+    deliverToOrigin(relayLink->take(), now + 5000);
+    origin->service(now + 5000);
+    TEST_ASSERT_EQUAL_UINT8(MESH_READING, originLink->take().data[1]);
+}
+
+void test_full_queue_sends_no_ack()
+{
+    connect(0);
+
+    // Fill the relay's queue with readings from one origin
+    uint32_t now = 10;
+    for (uint8_t i = 0; i < MeshRelay::QUEUE_SIZE; i++)
+    {
+        origin->queue(meshReading(i));
+        origin->service(now);
+        deliverToRelay(originLink->take(), now);
+        deliverToOrigin(relayLink->take(), now);
+        now += 10;
+    }
+    TEST_ASSERT_EQUAL_UINT32(MeshRelay::QUEUE_SIZE, relay->getRelayedCount());
+
+    origin->queue(meshReading(99));
+    origin->service(now);
+    deliverToRelay(originLink->take(), now);
+    TEST_ASSERT_TRUE(relayLink->sent.empty());
+    TEST_ASSERT_TRUE(origin->hasPending());
+
+    // Once the relay publishes one, the retry gets through
+    RelayedReading relayed;
+    TEST_ASSERT_TRUE(relay->popRelayed(relayed));
+    origin->service(now + RETRY_MS);
+    deliverToRelay(originLink->take(), now + RETRY_MS);
+    FakeLink::Frame ack = relayLink->take();
+    TEST_ASSERT_EQUAL_UINT8(MESH_ACK, ack.data[1]);
+    deliverToOrigin(ack, now + RETRY_MS);
+    TEST_ASSERT_FALSE(origin->hasPending());
+    TEST_ASSERT_EQUAL_UINT32(MeshRelay::QUEUE_SIZE + 1, relay->getRelayedCount());
+}
+
+void test_rebooted_origin_is_not_deduplicated()
+{
+    connect(0);
+    origin->queue(meshReading(30));
+    origin->service(10);
+    deliverToRelay(originLink->take(), 10);
+    deliverToOrigin(relayLink->take(), 10);
+
+    // Deep sleep and wake: a new instance starts over at the same seq
+    delete origin;
+    origin = new MeshRelay(*originLink, "BIN_ORIGIN", 5000, RELAY_TIMEOUT_MS, RETRY_MS, MAX_RETRIES);
+    uint32_t wake = RELAY_TIMEOUT_MS + 10;
+    relay->service(wake);
+    deliverToOrigin(relayLink->take(), wake);
+    origin->queue(meshReading(31));
+    origin->service(wake);
+    deliverToRelay(originLink->take(), wake);
+    deliverToOrigin(relayLink->take(), wake);
+
+    TEST_ASSERT_EQUAL_UINT32(2, relay->getRelayedCount());
+    RelayedReading relayed;
+    relay->popRelayed(relayed);
+    TEST_ASSERT_TRUE(relay->popRelayed(relayed));
+    TEST_ASSERT_EQUAL_UINT8(31, relayed.data.reading.fillLevel);
+}
+
+void test_seeded_seq_is_used()
+{
+    origin->seedSeq(200);
+    connect(0);
+    origin->queue(meshReading(10));
+    origin->service(10);
+    TEST_ASSERT_EQUAL_UINT8(201, originLink->take().data[2]);
+}
+
+/**
+ * A READING frame as an origin would send it, with any id bytes.
+ */
+static uint8_t readingFrame(uint8_t *frame, const char *id, uint8_t idLength, uint8_t seq)
+{
+    frame[0] = MESH_PROTOCOL_VERSION;
+    frame[1] = MESH_READING;
+    frame[2] = seq;
+    frame[3] = idLength;
+    memcpy(frame + MESH_HEADER_SIZE, id, idLength);
+    uint8_t length = MESH_HEADER_SIZE + idLength;
+    frame[length++] = 50;
+    frame[length++] = 70;
+    frame[length++] = 0x0A;
+    frame[length++] = 0x0F;
+    return length;
+}
+
+void test_valid_mesh_ids()
+{
+    TEST_ASSERT_TRUE(isValidMeshId("BIN-002"));
+    TEST_ASSERT_TRUE(isValidMeshId("BIN_CI_001"));
+    TEST_ASSERT_FALSE(isValidMeshId(""));
+    TEST_ASSERT_FALSE(isValidMeshId("BIN/002"));
+    TEST_ASSERT_FALSE(isValidMeshId("BIN+"));
+    TEST_ASSERT_FALSE(isValidMeshId("#"));
+    TEST_ASSERT_FALSE(isValidMeshId("BIN 002"));
+    TEST_ASSERT_FALSE(isValidMeshId("all"));
+    TEST_ASSERT_FALSE(isValidMeshId("group"));
+    TEST_ASSERT_FALSE(isValidMeshId("BIN-0000000000002")); // 17 characters
+}
+
+void test_invalid_origin_ids_are_dropped()
+{
+    relay->setUplink(true);
+    relay->service(0);
+    relayLink->take();
+
+    const char *ids[] = {"BIN/002", "BIN+", "#", "all"};
+    uint8_t frame[MESH_MAX_FRAME_SIZE];
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        uint8_t length = readingFrame(frame, ids[i], strlen(ids[i]), 1);
+        relay->onReceive(ORIGIN_MAC, frame, length, 10);
+    }
+    // A NUL inside the id would otherwise cut it down to an allowed one
+    uint8_t length = readingFrame(frame, "BIN-002\0/x", 10, 1);
+    relay->onReceive(ORIGIN_MAC, frame, length, 10);
+
+    TEST_ASSERT_TRUE(relayLink->sent.empty());
+    TEST_ASSERT_EQUAL_UINT32(0, relay->getRelayedCount());
+}
+
+void test_only_allowed_origins_are_relayed()
+{
+    relay->setUplink(true);
+    relay->service(0);
+    relayLink->take();
+
+    uint8_t frame[MESH_MAX_FRAME_SIZE];
+    // Unknown bin, and a frame claiming to be the relay itself
+    uint8_t length = readingFrame(frame, "BIN-999", 7, 1);
+    relay->onReceive(ORIGIN_MAC, frame, length, 10);
+    length = readingFrame(frame, "BIN_RELAY", 9, 1);
+    relay->onReceive(ORIGIN_MAC, frame, length, 10);
+    TEST_ASSERT_TRUE(relayLink->sent.empty());
+    TEST_ASSERT_EQUAL_UINT32(0, relay->getRelayedCount());
+
+    length = readingFrame(frame, "BIN-002", 7, 1);
+    relay->onReceive(ORIGIN_MAC, frame, length, 10);
+    TEST_ASSERT_EQUAL_UINT8(MESH_ACK, relayLink->take().data[1]);
+    RelayedReading relayed;
+    TEST_ASSERT_TRUE(relay->popRelayed(relayed));
+    TEST_ASSERT_EQUAL_STRING("BIN-002", relayed.originId);
+}
+
+void test_no_allowlist_relays_nothing()
+{
+    MeshRelay open(*relayLink, "BIN_OPEN");
+    open.setUplink(true);
+    uint8_t frame[MESH_MAX_FRAME_SIZE];
+    uint8_t length = readingFrame(frame, "BIN-002", 7, 1);
+    open.onReceive(ORIGIN_MAC, frame, length, 10);
+    TEST_ASSERT_TRUE(relayLink->sent.empty());
+    TEST_ASSERT_EQUAL_UINT32(0, open.getRelayedCount());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_reading_is_relayed_and_acknowledged);
+    RUN_TEST(test_dropped_ack_is_resent_and_deduplicated);
+    RUN_TEST(test_relay_is_forgotten_after_max_retries);
+    RUN_TEST(test_full_queue_sends_no_ack);
+    RUN_TEST(test_rebooted_origin_is_not_deduplicated);
+    RUN_TEST(test_seeded_seq_is_used);
+    RUN_TEST(test_valid_mesh_ids);
+    RUN_TEST(test_invalid_origin_ids_are_dropped);
+    RUN_TEST(test_only_allowed_origins_are_relayed);
+    RUN_TEST(test_no_allowlist_relays_nothing);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+#include <unity.h>
+#include <string.h>
+#include "PowerAccounting.h"
+
+static const uint64_t SECOND_US = 1000000;
+
+// Chip states are absolute, loads add on top
+static const float CURRENT_MA[POWER_STATE_COUNT] = {
+    20.0f,  // modemSleep
+    0.8f,   // lightSleep
+    0.01f,  // deepSleep
+    100.0f, // radio
+    50.0f,  // tls
+    15.0f,  // sampling
+    200.0f, // servo
+};
+
+static PowerLedger ledger;
+
+void setUp()
+{
+    memset(&ledger, 0, sizeof(ledger));
+}
+
+void tearDown()
+{
+}
+
+static uint32_t seconds(const PowerAccounting &accounting, PowerState state)
+{
+    return (uint32_t)(accounting.getTimeUs(state) / SECOND_US);
+}
+
+void test_awake_time_is_modem_sleep()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(2 * SECOND_US);
+    accounting.update(12 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(10, seconds(accounting, POWER_MODEM_SLEEP));
+    TEST_ASSERT_EQUAL_UINT32(10, (uint32_t)(accounting.getTotalUs() / SECOND_US));
+
+    // Time going backwards books nothing
+    accounting.update(5 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(10, seconds(accounting, POWER_MODEM_SLEEP));
+}
+
+void test_loads_add_on_top()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(0);
+    accounting.set(POWER_RADIO_CONNECTED, true, 1 * SECOND_US);
+    accounting.set(POWER_SERVO, true, 2 * SECOND_US);
+    accounting.set(POWER_SERVO, false, 3 * SECOND_US);
+    accounting.set(POWER_RADIO_CONNECTED, false, 4 * SECOND_US);
+    accounting.update(10 * SECOND_US);
+
+    TEST_ASSERT_EQUAL_UINT32(3, seconds(accounting, POWER_RADIO_CONNECTED));
+    TEST_ASSERT_EQUAL_UINT32(1, seconds(accounting, POWER_SERVO));
+    // Loads don't count towards the total
+    TEST_ASSERT_EQUAL_UINT32(10, (uint32_t)(accounting.getTotalUs() / SECOND_US));
+}
+
+void test_repeated_set_and_chip_states_are_ignored()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(0);
+    accounting.set(POWER_SAMPLING, true, 1 * SECOND_US);
+    accounting.set(POWER_SAMPLING, true, 3 * SECOND_US); // Doesn't restart the load
+    accounting.set(POWER_SAMPLING, false, 4 * SECOND_US);
+    accounting.set(POWER_SAMPLING, false, 9 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(3, seconds(accounting, POWER_SAMPLING));
+
+    accounting.set(POWER_LIGHT_SLEEP, true, 5 * SECOND_US);
+    TEST_ASSERT_FALSE(accounting.isActive(POWER_LIGHT_SLEEP));
+}
+
+void test_open_load_is_booked_on_update()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(0);
+    accounting.set(POWER_RADIO_CONNECTED, true, 0);
+    accounting.update(5 * SECOND_US);
+    TEST_ASSERT_TRUE(accounting.isActive(POWER_RADIO_CONNECTED));
+    TEST_ASSERT_EQUAL_UINT32(5, seconds(accounting, POWER_RADIO_CONNECTED));
+
+    // Not booked twice
+    accounting.update(8 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(8, seconds(accounting, POWER_RADIO_CONNECTED));
+}
+
+void test_light_sleep_moves_out_of_modem_sleep()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(0);
+    accounting.add(POWER_LIGHT_SLEEP, 3 * SECOND_US);
+    accounting.update(10 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(7, seconds(accounting, POWER_MODEM_SLEEP));
+    TEST_ASSERT_EQUAL_UINT32(3, seconds(accounting, POWER_LIGHT_SLEEP));
+    TEST_ASSERT_EQUAL_UINT32(10, (uint32_t)(accounting.getTotalUs() / SECOND_US));
+}
+
+void test_deep_sleep_is_booked_across_boots()
+{
+    PowerAccounting before(ledger, CURRENT_MA);
+    before.begin(0);
+    before.update(10 * SECOND_US);
+    before.markSleepStart(100 * SECOND_US);
+
+    // Same ledger after the wake, as with RTC memory
+    PowerAccounting after(ledger, CURRENT_MA);
+    after.begin(0);
+    after.markWake(160 * SECOND_US);
+    after.update(5 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(60, seconds(after, POWER_DEEP_SLEEP));
+    TEST_ASSERT_EQUAL_UINT32(15, seconds(after, POWER_MODEM_SLEEP));
+
+    // A wake without a recorded sleep (power-on) adds nothing
+    after.markWake(500 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(60, seconds(after, POWER_DEEP_SLEEP));
+}
+
+void test_average_current_and_projected_life()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    TEST_ASSERT_EQUAL_FLOAT(0, accounting.getAverageCurrentMa());
+    TEST_ASSERT_EQUAL_FLOAT(0, accounting.getProjectedLifeHours(2000));
+
+    accounting.begin(0);
+    accounting.set(POWER_RADIO_CONNECTED, true, 0);
+    accounting.update(10 * SECOND_US);
+    accounting.set(POWER_RADIO_CONNECTED, false, 10 * SECOND_US);
+    accounting.add(POWER_DEEP_SLEEP, 30 * SECOND_US);
+
+    // (10 s * (20 + 100) mA + 30 s * 0.01 mA) / 40 s
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 30.0075f, accounting.getAverageCurrentMa());
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 3000.0f / 30.0075f, accounting.getProjectedLifeHours(3000));
+}
+
+void test_reset_clears_ledger()
+{
+    PowerAccounting accounting(ledger, CURRENT_MA);
+    accounting.begin(0);
+    accounting.set(POWER_SAMPLING, true, 0);
+    accounting.update(10 * SECOND_US);
+    accounting.markSleepStart(50 * SECOND_US);
+    accounting.reset();
+
+    TEST_ASSERT_EQUAL_UINT32(0, (uint32_t)(accounting.getTotalUs() / SECOND_US));
+    TEST_ASSERT_EQUAL_UINT32(0, seconds(accounting, POWER_SAMPLING));
+    TEST_ASSERT_TRUE(ledger.sleepStartUs == 0);
+
+    // A load that is still running counts from the reset on
+    accounting.update(12 * SECOND_US);
+    TEST_ASSERT_EQUAL_UINT32(2, seconds(accounting, POWER_SAMPLING));
+    TEST_ASSERT_EQUAL_UINT32(2, seconds(accounting, POWER_MODEM_SLEEP));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_awake_time_is_modem_sleep);
+    RUN_TEST(test_loads_add_on_top);
+    RUN_TEST(test_repeated_set_and_chip_states_are_ignored);
+    RUN_TEST(test_open_load_is_booked_on_update);
+    RUN_TEST(test_light_sleep_moves_out_of_modem_sleep);
+    RUN_TEST(test_deep_sleep_is_booked_across_boots);
+    RUN_TEST(test_average_current_and_projected_life);
+    RUN_TEST(test_reset_clears_ledger);
+    return UNITY_END();
+}
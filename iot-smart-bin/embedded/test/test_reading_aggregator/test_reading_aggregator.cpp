@@ -0,0 +1,121 @@
+#include <unity.h>
+#include "ReadingAggregator.h"
+
+static const uint32_t HOUR_MS = 3600000;
+
+static ReadingAggregator aggregator;
+
+void setUp()
+{
+    aggregator.reset();
+}
+
+void tearDown()
+{
+}
+
+void test_empty_period()
+{
+    TEST_ASSERT_TRUE(aggregator.isEmpty());
+    TEST_ASSERT_EQUAL_UINT16(0, aggregator.getCount());
+    TEST_ASSERT_EQUAL_FLOAT(0, aggregator.getFillMean());
+    TEST_ASSERT_EQUAL_FLOAT(0, aggregator.getBatteryTrendPerHour());
+}
+
+void test_fill_statistics()
+{
+    aggregator.add(0, 30, 90);
+    aggregator.add(1000, 10, 90);
+    aggregator.add(2000, 20, 90);
+
+    TEST_ASSERT_FALSE(aggregator.isEmpty());
+    TEST_ASSERT_EQUAL_UINT16(3, aggregator.getCount());
+    TEST_ASSERT_EQUAL_FLOAT(10, aggregator.getFillMin());
+    TEST_ASSERT_EQUAL_FLOAT(30, aggregator.getFillMax());
+    TEST_ASSERT_EQUAL_FLOAT(20, aggregator.getFillMean());
+    TEST_ASSERT_EQUAL_FLOAT(20, aggregator.getFillLast());
+    TEST_ASSERT_EQUAL_FLOAT(90, aggregator.getBatteryLast());
+}
+
+void test_battery_trend_is_least_squares_slope()
+{
+    // The end points alone would give -1 %/h, the fit over all four gives -0.9
+    aggregator.add(0, 50, 90);
+    aggregator.add(HOUR_MS, 50, 88.5);
+    aggregator.add(2 * HOUR_MS, 50, 88.5);
+    aggregator.add(3 * HOUR_MS, 50, 87);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -0.9f, aggregator.getBatteryTrendPerHour());
+}
+
+void test_battery_trend_is_per_hour()
+{
+    // Offset start and readings 15 min apart
+    aggregator.add(5000, 50, 80);
+    aggregator.add(5000 + HOUR_MS / 4, 50, 80.5);
+    aggregator.add(5000 + HOUR_MS / 2, 50, 81);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 2.0f, aggregator.getBatteryTrendPerHour());
+}
+
+void test_battery_trend_needs_two_distinct_times()
+{
+    aggregator.add(1000, 50, 90);
+    TEST_ASSERT_EQUAL_FLOAT(0, aggregator.getBatteryTrendPerHour());
+
+    aggregator.add(1000, 50, 80);
+    TEST_ASSERT_EQUAL_FLOAT(0, aggregator.getBatteryTrendPerHour());
+}
+
+void test_battery_trend_survives_millis_wrap()
+{
+    uint32_t start = UINT32_MAX - HOUR_MS / 2;
+    aggregator.add(start, 50, 90);
+    aggregator.add(start + HOUR_MS, 50, 89); // Wrapped
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, -1.0f, aggregator.getBatteryTrendPerHour());
+}
+
+void test_count_is_capped_at_uint16_max()
+{
+    for (uint32_t i = 0; i < UINT16_MAX; i++)
+    {
+        aggregator.add(i, 40, 90);
+    }
+    TEST_ASSERT_EQUAL_UINT16(UINT16_MAX, aggregator.getCount());
+
+    // Past the cap the count and mean stop, but min/max/last still follow the bin
+    aggregator.add(UINT16_MAX, 95, 90);
+    aggregator.add(UINT16_MAX + 1, 5, 90);
+    aggregator.add(UINT16_MAX + 2, 60, 90);
+    TEST_ASSERT_EQUAL_UINT16(UINT16_MAX, aggregator.getCount());
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 40, aggregator.getFillMean());
+    TEST_ASSERT_EQUAL_FLOAT(5, aggregator.getFillMin());
+    TEST_ASSERT_EQUAL_FLOAT(95, aggregator.getFillMax());
+    TEST_ASSERT_EQUAL_FLOAT(60, aggregator.getFillLast());
+}
+
+void test_reset_starts_new_period()
+{
+    aggregator.add(0, 70, 90);
+    aggregator.add(HOUR_MS, 80, 85);
+    aggregator.reset();
+    TEST_ASSERT_TRUE(aggregator.isEmpty());
+
+    // The new period's min/max start from its own first reading
+    aggregator.add(2 * HOUR_MS, 20, 84);
+    TEST_ASSERT_EQUAL_FLOAT(20, aggregator.getFillMin());
+    TEST_ASSERT_EQUAL_FLOAT(20, aggregator.getFillMax());
+    TEST_ASSERT_EQUAL_FLOAT(0, aggregator.getBatteryTrendPerHour());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_period);
+    RUN_TEST(test_fill_statistics);
+    RUN_TEST(test_battery_trend_is_least_squares_slope);
+    RUN_TEST(test_battery_trend_is_per_hour);
+    RUN_TEST(test_battery_trend_needs_two_distinct_times);
+    RUN_TEST(test_battery_trend_survives_millis_wrap);
+    RUN_TEST(test_count_is_capped_at_uint16_max);
+    RUN_TEST(test_reset_starts_new_period);
+    return UNITY_END();
+}
@@ -0,0 +1,2 @@
+ALTER TABLE `readings` ADD `received_at` integer;--> statement-breakpoint
+ALTER TABLE `readings` ADD `clock_quality` text DEFAULT 'none';
\ No newline at end of file
@@ -0,0 +1,18 @@
+PRAGMA foreign_keys=OFF;--> statement-breakpoint
+CREATE TABLE `__new_devices` (
+	`id` text PRIMARY KEY NOT NULL,
+	`name` text,
+	`location` text DEFAULT 'Unknown',
+	`threshold` integer,
+	`deployed` integer DEFAULT false,
+	`last_seen` integer,
+	`status` text DEFAULT 'offline',
+	`battery_percentage` real DEFAULT 100,
+	`voltage` real DEFAULT 5,
+	`is_tilted` integer DEFAULT false
+);
+--> statement-breakpoint
+INSERT INTO `__new_devices`("id", "name", "location", "threshold", "deployed", "last_seen", "status", "battery_percentage", "voltage", "is_tilted") SELECT "id", "name", "location", NULLIF("threshold", 85), "deployed", "last_seen", "status", "battery_percentage", "voltage", "is_tilted" FROM `devices`;--> statement-breakpoint
+DROP TABLE `devices`;--> statement-breakpoint
+ALTER TABLE `__new_devices` RENAME TO `devices`;--> statement-breakpoint
+PRAGMA foreign_keys=ON;
@@ -1,11 +1,15 @@
 import { integer, real, sqliteTable, text } from "drizzle-orm/sqlite-core";
 import { sql } from "drizzle-orm";
 
+// Firmware default, shown for bins that don't have a threshold of their own
+export const DEFAULT_THRESHOLD = 85;
+
 export const devices = sqliteTable("devices", {
   id: text("id").primaryKey(),
   name: text("name"),
   location: text("location").default("Unknown"),
-  threshold: integer("threshold").default(85).notNull(),
+  // null: the bin follows its group/fleet threshold (DEFAULT_THRESHOLD when none is set)
+  threshold: integer("threshold"),
   deployed: integer("deployed", { mode: "boolean" }).default(false),
   lastSeen: integer("last_seen", { mode: "timestamp" }),
   status: text("status").default("offline"),
@@ -23,9 +27,12 @@ export const readings = sqliteTable("readings", {
   batteryPercentage: real("battery_percentage").notNull(),
   voltage: real("voltage").default(0),
   isTilted: integer("is_tilted", { mode: "boolean" }).notNull(),
+  // Device sample time when its clock was synced, otherwise the arrival time (see clockQuality)
   createdAt: integer("created_at", { mode: "timestamp" })
     .default(sql`(unixepoch())`)
     .notNull(),
+  receivedAt: integer("received_at", { mode: "timestamp" }),
+  clockQuality: text("clock_quality").default("none"),
 });
 
 export const systemSettings = sqliteTable("system_settings", {
@@ -31,7 +31,7 @@ export type Device = {
   id: string;
   name: string | null;
   location: string | null;
-  threshold: number;
+  threshold: number | null;
   deployed: boolean | null;
   lastSeen: Date | null;
   status: string | null;
@@ -41,10 +41,12 @@ const EditableCell = ({
   value,
   onSave,
   type = "text",
+  placeholder,
 }: {
   value: string | number;
   onSave: (val: string | number) => void;
   type?: "text" | "number";
+  placeholder?: string;
 }) => {
   const [isEditing, setIsEditing] = useState(false);
   const [currentValue, setCurrentValue] = useState(value);
@@ -64,13 +66,16 @@ const EditableCell = ({
         value={currentValue}
         onChange={(e) =>
           setCurrentValue(
-            type === "number" ? Number(e.target.value) : e.target.value,
+            type === "number" && e.target.value !== ""
+              ? Number(e.target.value)
+              : e.target.value,
           )
         }
         onBlur={handleBlur}
         onKeyDown={(e) => {
           if (e.key === "Enter") handleBlur();
         }}
+        placeholder={placeholder}
         className="h-8 w-full"
       />
     );
@@ -81,7 +86,11 @@ const EditableCell = ({
       onClick={() => setIsEditing(true)}
       className="cursor-pointer hover:bg-slate-100 dark:hover:bg-slate-800 p-1 rounded border border-transparent hover:border-slate-200 min-h-6"
     >
-      {value}
+      {value === "" && placeholder ? (
+        <span className="text-muted-foreground">{placeholder}</span>
+      ) : (
+        value
+      )}
     </div>
   );
 };
@@ -230,8 +239,15 @@ export const createColumns = (
       <div className="w-20">
         <EditableCell
           type="number"
-          value={row.getValue("threshold")}
+          value={row.original.threshold ?? ""}
+          placeholder="Group"
           onSave={(val) => {
+            // Cleared: follow the group/fleet threshold again
+            if (val === "") {
+              onUpdate(row.original.id, { threshold: null });
+              return;
+            }
+
             const num = Number(val);
 
             if (isNaN(num) || num < 0 || num > 100) {
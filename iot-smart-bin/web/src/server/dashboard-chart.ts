@@ -2,7 +2,7 @@ import { createServerFn } from "@tanstack/react-start";
 import { desc, eq } from "drizzle-orm";
 import z from "zod";
 import { authMiddleware } from "./auth";
-import { devices, readings } from "@/db/schema";
+import { DEFAULT_THRESHOLD, devices, readings } from "@/db/schema";
 import { db } from "@/db";
 
 export const getDeviceReadings = createServerFn({ method: "GET" })
@@ -24,6 +24,6 @@ export const getDeviceReadings = createServerFn({ method: "GET" })
 
     return {
       history: history.reverse(),
-      threshold: deviceSettings.length > 0 ? deviceSettings[0].threshold : 85,
+      threshold: deviceSettings[0]?.threshold ?? DEFAULT_THRESHOLD,
     };
   });
@@ -8,8 +8,14 @@ import {
   getLiveDeviceState,
   getMqttClient,
 } from "./mqtt-client";
+import { getLatencyStats, trackRequest } from "./latency";
 import { db } from "@/db";
-import { devices, readings, systemSettings } from "@/db/schema";
+import {
+  DEFAULT_THRESHOLD,
+  devices,
+  readings,
+  systemSettings,
+} from "@/db/schema";
 
 export const getDashboardData = createServerFn({ method: "GET" }).handler(
   async () => {
@@ -82,7 +88,7 @@ export const getDashboardData = createServerFn({ method: "GET" }).handler(
           id: dbDev.id,
           name: dbDev.name ?? dbDev.id,
           location: dbDev.location ?? "Unknown",
-          threshold: dbDev.threshold,
+          threshold: dbDev.threshold ?? DEFAULT_THRESHOLD,
           fillLevel: fillLevel ?? 0,
           batteryPercentage: batteryPercentage,
           voltage: voltage,
@@ -109,10 +115,18 @@ export const pingDevice = createServerFn({ method: "POST" })
     const client = getMqttClient();
 
     if (client && client.connected) {
-      console.log(`Pinging device: cmd/ping/${data.id}`);
-      client.publish(`cmd/ping/${data.id}`, "PING");
-      return { success: true };
+      // The device echoes this id in the data message that serves the ping
+      const requestId = trackRequest(data.id, "ping");
+      console.log(`Pinging device: cmd/ping/${data.id} (request ${requestId})`);
+      client.publish(`cmd/ping/${data.id}`, JSON.stringify({ requestId }));
+      return { success: true, requestId };
     }
 
     throw new Error("MQTT Broker not connected");
   });
+
+export const getRequestLatency = createServerFn({ method: "GET" }).handler(
+  async () => {
+    return getLatencyStats();
+  },
+);
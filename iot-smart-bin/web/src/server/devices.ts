@@ -5,6 +5,7 @@ import { db } from "@/db";
 import { devices, readings } from "@/db/schema";
 import { authMiddleware } from "@/server/auth";
 import { getMqttClient } from "@/server/mqtt-client"; // Import the MQTT client
+import { trackRequest } from "@/server/latency";
 
 export const getAllDevices = createServerFn({ method: "GET" }).handler(
   async () => {
@@ -26,11 +27,19 @@ export const updateDeviceSettings = createServerFn({ method: "POST" })
     z.object({
       id: z.string(),
       location: z.string().optional(),
-      threshold: z.number().optional(),
+      // null clears the bin's own threshold, it then follows its group/fleet one
+      threshold: z.number().nullable().optional(),
       deployed: z.boolean().optional(),
     }),
   )
   .handler(async ({ data }) => {
+    // Read before the update: the device only samples when its threshold changes
+    const [previous] = await db
+      .select({ threshold: devices.threshold })
+      .from(devices)
+      .where(eq(devices.id, data.id))
+      .limit(1);
+
     await db
       .update(devices)
       .set({
@@ -44,16 +53,35 @@ export const updateDeviceSettings = createServerFn({ method: "POST" })
       const client = getMqttClient();
 
       const topic = `bins/${data.id}/config`;
-      const payload = JSON.stringify({ threshold: data.threshold });
+      const config =
+        data.threshold === null
+          ? { inherit: true }
+          : { threshold: data.threshold };
+
+      // A new threshold of its own makes the device sample. Clearing it resolves to a
+      // group/fleet threshold the server doesn't know, so there may be no sample to wait for
+      const willSample =
+        data.threshold !== null && data.threshold !== previous?.threshold;
 
       try {
-        await new Promise<void>((resolve, reject) => {
-          client.publish(topic, payload, { qos: 1, retain: true }, (err) => {
-            if (err) reject(err);
-            else resolve();
-          });
+        if (willSample) {
+          // The request id goes in a non-retained copy, sent first. In the retained config it
+          // would be replayed on every later subscribe and never answered
+          const requestId = trackRequest(data.id, "config");
+          await client.publishAsync(
+            topic,
+            JSON.stringify({ ...config, requestId }),
+            { qos: 1 },
+          );
+        }
+        // The retained copy then changes nothing on a connected device (same threshold)
+        await client.publishAsync(topic, JSON.stringify(config), {
+          qos: 1,
+          retain: true,
         });
-        console.log(`[MQTT] Successfully sent threshold: ${data.threshold}%`);
+        console.log(
+          `[MQTT] Successfully sent threshold: ${data.threshold ?? "inherited"}`,
+        );
       } catch (err) {
         console.error(`[MQTT] Publish failed:`, err);
       }
@@ -0,0 +1,146 @@
+import z from "zod";
+
+/**
+ * Request/response latency for pings and config updates.
+ *
+ * Each request sent to a device carries a short id. The device echoes the ids in the data
+ * message that serves them, together with its own millis() timestamps, so the end-to-end
+ * latency can be split into stages. Device and server clocks are never compared directly:
+ * device stages are differences of device timestamps, and "network" is what is left of the
+ * end-to-end time (both broker legs).
+ */
+
+// Requests nobody answered are forgotten after this long (e.g. offline or rate-limited bins)
+const PENDING_TTL_MS = 5 * 60 * 1000;
+// Rolling window of samples kept per stage
+const MAX_SAMPLES = 500;
+
+export const DeviceTimingSchema = z.object({
+  receivedMs: z.array(z.number()),
+  sampleStartMs: z.number(),
+  sampleEndMs: z.number(),
+  publishMs: z.number(),
+});
+export type DeviceTiming = z.infer<typeof DeviceTimingSchema>;
+
+export const LATENCY_STAGES = [
+  "endToEnd", // server publish -> data message received
+  "network", // endToEnd minus the time spent on the device
+  "queue", // request received -> burst start (0 if it joined a running burst)
+  "sample", // burst start -> burst end
+  "publish", // burst end -> publish
+] as const;
+export type LatencyStage = (typeof LATENCY_STAGES)[number];
+
+export interface LatencyStats {
+  count: number;
+  p50: number;
+  p95: number;
+  p99: number;
+  max: number;
+}
+
+interface PendingRequest {
+  deviceId: string;
+  kind: "ping" | "config";
+  sentAt: number;
+}
+
+const pendingRequests = new Map<string, PendingRequest>();
+const samples = Object.fromEntries(
+  LATENCY_STAGES.map((stage) => [stage, [] as number[]]),
+) as Record<LatencyStage, number[]>;
+
+const addSample = (stage: LatencyStage, value: number) => {
+  const window = samples[stage];
+  window.push(value);
+  if (window.length > MAX_SAMPLES) window.shift();
+};
+
+const prunePending = (now: number) => {
+  for (const [id, request] of pendingRequests) {
+    if (now - request.sentAt > PENDING_TTL_MS) pendingRequests.delete(id);
+  }
+};
+
+/**
+ * Creates a request id for a message about to be sent to a device and starts its clock.
+ */
+export const trackRequest = (
+  deviceId: string,
+  kind: PendingRequest["kind"],
+): string => {
+  const now = Date.now();
+  prunePending(now);
+
+  const requestId = crypto.randomUUID().slice(0, 8);
+  pendingRequests.set(requestId, { deviceId, kind, sentAt: now });
+  return requestId;
+};
+
+/**
+ * Records the stages of every tracked request served by one data message.
+ * Unknown ids (expired, or sent by another server instance) are ignored.
+ */
+export const recordResponse = (
+  deviceId: string,
+  requestIds: string[],
+  timing: DeviceTiming | undefined,
+  receivedAt = Date.now(),
+) => {
+  requestIds.forEach((requestId, index) => {
+    const request = pendingRequests.get(requestId);
+    if (!request || request.deviceId !== deviceId) return;
+    pendingRequests.delete(requestId);
+
+    const endToEnd = receivedAt - request.sentAt;
+    addSample("endToEnd", endToEnd);
+
+    const receivedMs = timing?.receivedMs[index];
+    if (!timing || receivedMs === undefined) {
+      console.log(
+        `[Latency] ${deviceId} ${request.kind} ${requestId}: ${endToEnd} ms end-to-end`,
+      );
+      return;
+    }
+
+    const queue = Math.max(0, timing.sampleStartMs - receivedMs);
+    const sample = timing.sampleEndMs - timing.sampleStartMs;
+    const publish = timing.publishMs - timing.sampleEndMs;
+    const network = Math.max(0, endToEnd - (timing.publishMs - receivedMs));
+
+    addSample("network", network);
+    addSample("queue", queue);
+    addSample("sample", sample);
+    addSample("publish", publish);
+
+    console.log(
+      `[Latency] ${deviceId} ${request.kind} ${requestId}: ${endToEnd} ms end-to-end ` +
+        `(network ${network}, queue ${queue}, sample ${sample}, publish ${publish})`,
+    );
+  });
+};
+
+const percentile = (sorted: number[], p: number) =>
+  sorted[Math.min(sorted.length - 1, Math.ceil((p / 100) * sorted.length) - 1)];
+
+/**
+ * Per-stage distributions over the rolling window, in milliseconds.
+ */
+export const getLatencyStats = (): Record<LatencyStage, LatencyStats> => {
+  const stats = {} as Record<LatencyStage, LatencyStats>;
+  for (const stage of LATENCY_STAGES) {
+    const sorted = [...samples[stage]].sort((a, b) => a - b);
+    stats[stage] =
+      sorted.length === 0
+        ? { count: 0, p50: 0, p95: 0, p99: 0, max: 0 }
+        : {
+            count: sorted.length,
+            p50: percentile(sorted, 50),
+            p95: percentile(sorted, 95),
+            p99: percentile(sorted, 99),
+            max: sorted[sorted.length - 1],
+          };
+  }
+  return stats;
+};
@@ -6,23 +6,69 @@ import type { MqttClient } from "mqtt";
 import { env } from "@/env";
 import { db } from "@/db"; // Import DB
 import { devices, readings } from "@/db/schema";
+import { DeviceTimingSchema, recordResponse } from "@/server/latency";
 
 const SUBSCRIPTION_TOPICS = [
   "bins/+/data",
   "bins/+/status",
   "bins/+/get-config",
+  "bins/+/summary",
 ];
 
 // --- Types ---
-const BinDataSchema = z.object({
+// Device timestamps (see the firmware's Device Time section). Without a synced clock there is no sampledAt.
+const DeviceTimeSchema = z.object({
+  clock: z.enum(["ntp", "rtc", "none"]).default("none"),
+  sampledAt: z.number().optional(),
+});
+
+// A device timestamp further ahead than this is treated as a bad clock
+const MAX_CLOCK_AHEAD_MS = 60 * 1000;
+
+/**
+ * Time a reading was taken: the device's sample time when its clock was synced, otherwise the arrival time.
+ */
+const resolveReadingTime = (
+  { clock, sampledAt }: z.infer<typeof DeviceTimeSchema>,
+  receivedAt: Date,
+) => {
+  if (
+    clock === "none" ||
+    sampledAt === undefined ||
+    sampledAt > receivedAt.getTime() + MAX_CLOCK_AHEAD_MS
+  ) {
+    return { createdAt: receivedAt, clockQuality: "none" };
+  }
+  return { createdAt: new Date(sampledAt), clockQuality: clock };
+};
+
+const BinDataSchema = DeviceTimeSchema.extend({
   deviceId: z.string(),
   fillLevel: z.number(),
   batteryPercentage: z.number(),
   voltage: z.number(),
   isTilted: z.boolean(),
+  // Present when the reading serves pings/config updates (see server/latency.ts)
+  requestIds: z.array(z.string()).optional(),
+  timing: DeviceTimingSchema.optional(),
 });
 export type BinData = z.infer<typeof BinDataSchema>;
 
+// Periodic on-device aggregate, replaces the routine readings of that period
+const BinSummarySchema = DeviceTimeSchema.extend({
+  deviceId: z.string(),
+  periodMs: z.number(),
+  samples: z.number(),
+  fillMin: z.number(),
+  fillMax: z.number(),
+  fillMean: z.number(),
+  // Missing from firmware that predates it, fillMean is the closest then
+  fillLast: z.number().optional(),
+  batteryPercentage: z.number(),
+  batteryTrend: z.number(),
+  voltage: z.number(),
+});
+
 export interface Device {
   id: string;
   fillLevel: number;
@@ -146,6 +192,7 @@ const connect = () => {
       }
 
       case "data": {
+        const receivedAt = new Date();
         try {
           const json = JSON.parse(msgString);
           const result = BinDataSchema.safeParse(json);
@@ -157,8 +204,19 @@ const connect = () => {
               batteryPercentage,
               voltage,
               isTilted,
+              requestIds,
+              timing,
             } = result.data;
 
+            if (requestIds) {
+              recordResponse(
+                deviceId,
+                requestIds,
+                timing,
+                receivedAt.getTime(),
+              );
+            }
+
             // Update In-Memory Store
             deviceStore[deviceId] = {
               fillLevel,
@@ -187,7 +245,8 @@ const connect = () => {
               batteryPercentage,
               voltage,
               isTilted,
-              createdAt: new Date(),
+              receivedAt,
+              ...resolveReadingTime(result.data, receivedAt),
             });
           }
         } catch (e) {
@@ -196,6 +255,61 @@ const connect = () => {
         break;
       }
 
+      case "summary": {
+        const receivedAt = new Date();
+        try {
+          const json = JSON.parse(msgString);
+          const result = BinSummarySchema.safeParse(json);
+
+          if (result.success) {
+            const {
+              deviceId,
+              fillMean,
+              fillLast,
+              batteryPercentage,
+              voltage,
+            } = result.data;
+            const existing = deviceStore[deviceId] as
+              | (typeof deviceStore)[string]
+              | undefined;
+
+            deviceStore[deviceId] = {
+              // The live view shows where the bin is now, not the period average
+              fillLevel: fillLast ?? fillMean,
+              batteryPercentage,
+              voltage,
+              isTilted: existing?.isTilted ?? false,
+              lastSeen: Date.now(),
+              status: "online",
+            };
+
+            await db
+              .update(devices)
+              .set({
+                status: "online",
+                lastSeen: new Date(),
+                batteryPercentage: batteryPercentage,
+                voltage: voltage,
+              })
+              .where(eq(devices.id, deviceId));
+
+            // One row per summary period keeps the history charts working
+            await db.insert(readings).values({
+              deviceId,
+              fillLevel: fillMean,
+              batteryPercentage,
+              voltage,
+              isTilted: false,
+              receivedAt,
+              ...resolveReadingTime(result.data, receivedAt),
+            });
+          }
+        } catch (e) {
+          console.error("Failed to parse summary JSON or DB error:", e);
+        }
+        break;
+      }
+
       case "get-config": {
         console.log(`[Config] Request received for device: ${binId}`);
         try {
@@ -206,13 +320,22 @@ const connect = () => {
             .limit(1);
 
           const threshold =
-            deviceRecord.length > 0 ? deviceRecord[0].threshold : 85;
+            deviceRecord.length > 0 ? deviceRecord[0].threshold : null;
 
-          const responsePayload = JSON.stringify({ threshold });
+          // Without a threshold of its own the bin must fall back to its group/fleet one,
+          // a device threshold here would override them for good
+          const responsePayload = JSON.stringify(
+            threshold === null ? { inherit: true } : { threshold },
+          );
           const responseTopic = `bins/${binId}/config`;
 
           if (client) {
-            client.publish(responseTopic, responsePayload, { retain: false });
+            // Retained, so the device gets it on its next fresh subscribe without asking again.
+            // QoS 1, so a device that dropped offline meanwhile gets it queued in its session
+            client.publish(responseTopic, responsePayload, {
+              qos: 1,
+              retain: true,
+            });
             console.log(`[Config] Sent to ${binId}: ${responsePayload}`);
           }
         } catch (e) {
@@ -0,0 +1,114 @@
+/**
+ * Fleet simulator for the smart bin firmware.
+ *
+ * Models a fleet of bins that all boot together (e.g. after a site-wide power blip) and
+ * reports how evenly their publishes reach the broker, for the old lockstep schedule and
+ * for the hashed time-slot schedule.
+ *
+ * Usage: npm run sim:fleet -- [bins] [cycleMs]
+ */
+
+// Must match the firmware constants (embedded/src/main.cpp)
+const SAMPLE_INTERVAL_MS = 60;
+const TARGET_SAMPLES = 11;
+const BURST_MS = SAMPLE_INTERVAL_MS * TARGET_SAMPLES;
+const LOOP_DELAY_MS = 10;
+
+// WiFi + MQTT connect time varies a little between bins after a common power-on
+const BOOT_JITTER_MS = 3000;
+const SIMULATED_CYCLES = 30;
+const BUCKET_MS = 1000;
+
+/**
+ * 32-bit FNV-1a hash, identical to hashDeviceId() in the firmware.
+ */
+export function hashDeviceId(id: string): number {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < id.length; i++) {
+    hash ^= id.charCodeAt(i);
+    hash = Math.imul(hash, 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+/**
+ * Small seeded PRNG (mulberry32) so runs are reproducible.
+ */
+function createRandom(seed: number) {
+  let state = seed >>> 0;
+  return () => {
+    state = (state + 0x6d2b79f5) >>> 0;
+    let t = state;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+type Schedule = (deviceId: string, bootMs: number, cycleMs: number) => number[];
+
+// Before: the first cycle fires CYCLE_INTERVAL after boot and each burst restarts the cycle timer
+const lockstepSchedule: Schedule = (_deviceId, bootMs, cycleMs) => {
+  const publishes: number[] = [];
+  for (let k = 1; k <= SIMULATED_CYCLES; k++) {
+    publishes.push(bootMs + k * (cycleMs + LOOP_DELAY_MS) + BURST_MS);
+  }
+  return publishes;
+};
+
+// After: each bin samples at hash(BIN_ID) % cycle within a fixed grid
+const slottedSchedule: Schedule = (deviceId, bootMs, cycleMs) => {
+  const offset = hashDeviceId(deviceId) % cycleMs;
+  const publishes: number[] = [];
+  for (let k = 0; k < SIMULATED_CYCLES; k++) {
+    publishes.push(bootMs + offset + k * cycleMs + BURST_MS);
+  }
+  return publishes;
+};
+
+/**
+ * Peak-to-mean ratio of publishes per bucket, over the steady-state part of the run.
+ */
+function peakToMean(publishes: number[], cycleMs: number) {
+  const start = 2 * cycleMs;
+  const end = (SIMULATED_CYCLES - 2) * cycleMs;
+  const buckets = new Array<number>(Math.ceil((end - start) / BUCKET_MS)).fill(0);
+
+  for (const t of publishes) {
+    if (t >= start && t < end) {
+      buckets[Math.floor((t - start) / BUCKET_MS)]++;
+    }
+  }
+
+  const peak = Math.max(...buckets);
+  const mean = buckets.reduce((sum, count) => sum + count, 0) / buckets.length;
+  return { peak, mean, ratio: mean > 0 ? peak / mean : 0 };
+}
+
+function simulate(name: string, schedule: Schedule, bins: number, cycleMs: number) {
+  const random = createRandom(422);
+  const publishes: number[] = [];
+
+  for (let i = 1; i <= bins; i++) {
+    const deviceId = `BIN-${String(i).padStart(3, "0")}`;
+    const bootMs = random() * BOOT_JITTER_MS;
+    publishes.push(...schedule(deviceId, bootMs, cycleMs));
+  }
+
+  const { peak, mean, ratio } = peakToMean(publishes, cycleMs);
+  console.log(
+    `${name.padEnd(10)} peak ${String(peak).padStart(4)} msg/s | ` +
+      `mean ${mean.toFixed(2).padStart(6)} msg/s | ` +
+      `peak-to-mean ${ratio.toFixed(2)}`,
+  );
+}
+
+const bins = Number(process.argv[2] ?? 200);
+const cycleMs = Number(process.argv[3] ?? 10000);
+
+console.log(
+  `Simulating ${bins} bins, ${cycleMs} ms cycle, ` +
+    `booting within ${BOOT_JITTER_MS} ms of each other\n`,
+);
+simulate("Lockstep", lockstepSchedule, bins, cycleMs);
+simulate("Slotted", slottedSchedule, bins, cycleMs);
@@ -0,0 +1,39 @@
+# PlatformIO pre-script: gzips the web UI in data/ into the filesystem image directory (data_dir).
+# The server sends the .gz files as-is with Content-Encoding: gzip, and their MD5 as a strong ETag.
+# mtime is fixed so an unchanged asset produces the same bytes (and ETag) on every build.
+Import("env")
+
+import gzip
+import os
+
+source_dir = os.path.join(env.subst("$PROJECT_DIR"), "data")
+output_dir = env.subst("$PROJECT_DATA_DIR")
+
+os.makedirs(output_dir, exist_ok=True)
+
+expected = set()
+for name in sorted(os.listdir(source_dir)):
+    source_path = os.path.join(source_dir, name)
+    if not os.path.isfile(source_path):
+        continue
+
+    output_name = name + ".gz"
+    output_path = os.path.join(output_dir, output_name)
+    expected.add(output_name)
+
+    with open(source_path, "rb") as f:
+        compressed = gzip.compress(f.read(), compresslevel=9, mtime=0)
+
+    if os.path.exists(output_path):
+        with open(output_path, "rb") as f:
+            if f.read() == compressed:
+                continue
+
+    with open(output_path, "wb") as f:
+        f.write(compressed)
+    print("gzip_assets: %s %d -> %d bytes" % (name, os.path.getsize(source_path), len(compressed)))
+
+# Drop assets that were removed from data/
+for name in os.listdir(output_dir):
+    if name not in expected:
+        os.remove(os.path.join(output_dir, name))
@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include <SPIFFS.h>
+#include <MD5Builder.h>
 #include <WiFi.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
@@ -30,6 +31,15 @@ const unsigned char RED_LED_PIN = 12;    // blue wire
 const unsigned char PORT = 80;
 AsyncWebServer server(PORT);
 
+// --- Server-Sent Events ---
+// Lockout and door changes are pushed to the pages on /events instead of being polled.
+// Events: "lockout" (start, data = remaining ms), "remaining" (ms, every LOCKOUT_SYNC_INTERVAL_MS),
+// "lockout-end", and "door" ("open" / "closed"). A page gets the current state when it connects.
+AsyncEventSource events("/events");
+const unsigned long SSE_RETRY_MS = 3000;               // Browser reconnect delay after a lost connection
+const unsigned long LOCKOUT_SYNC_INTERVAL_MS = 10000; // Re-sends the remaining time so page timers don't drift
+unsigned long lastLockoutSyncTime = 0;
+
 Servo servo;
 const unsigned char SERVO_TIMER_ID = 0;
 const unsigned char SERVO_PERIOD = 50; // in Hz
@@ -125,19 +135,116 @@ bool isLockedOut()
   return RA_State == LOCKED_OUT || RA_State == LOCKED_OUT_WAIT;
 }
 
+bool isDoorOpen()
+{
+  return RA_State == DOOR_OPENING || RA_State == DOOR_OPEN;
+}
+
+/**
+ * @brief Pushes an event to every page connected to /events.
+ */
+void pushEvent(const char *event, const String &data)
+{
+  events.send(data.c_str(), event, millis());
+}
+
+// --- Static Web Assets ---
+// SPIFFS only holds the gzipped copies made at build time (gzip_assets.py). They are sent as-is with
+// Content-Encoding: gzip and a strong ETag (MD5 of the .gz), so a repeat visit costs a 304 and no body.
+// "no-cache" still revalidates every load: "/" depends on the lockout state and the pages change with a reflash.
+const char *ASSET_CACHE_CONTROL = "no-cache";
+
+struct WebAsset
+{
+  const char *path;
+  const char *contentType;
+  String etag; // Quoted, filled in by loadAssetETags()
+};
+
+enum WebAssetId
+{
+  ASSET_INDEX_HTML,
+  ASSET_SCRIPT_JS,
+  ASSET_ADMIN_HTML,
+  ASSET_ADMIN_JS,
+  ASSET_COOLDOWN_HTML,
+  ASSET_COOLDOWN_JS,
+  ASSET_STYLE_CSS,
+  ASSET_COUNT
+};
+
+WebAsset webAssets[ASSET_COUNT] = {
+    {"/index.html", "text/html"},
+    {"/script.js", "text/javascript"},
+    {"/admin.html", "text/html"},
+    {"/admin.js", "text/javascript"},
+    {"/cooldown.html", "text/html"},
+    {"/cooldown.js", "text/javascript"},
+    {"/style.css", "text/css"},
+};
+
+/**
+ * @brief Hashes every gzipped asset once at boot, so requests only compare strings.
+ */
+void loadAssetETags()
+{
+  for (WebAsset &asset : webAssets)
+  {
+    File file = SPIFFS.open(String(asset.path) + ".gz", "r");
+    if (!file)
+    {
+      Serial.printf("[ERROR] %s.gz not found in SPIFFS. Upload the filesystem image.\n", asset.path);
+      continue;
+    }
+
+    MD5Builder md5;
+    md5.begin();
+    md5.addStream(file, file.size());
+    md5.calculate();
+    asset.etag = "\"" + md5.toString() + "\"";
+    file.close();
+  }
+}
+
+/**
+ * @brief Sends a gzipped asset, or 304 Not Modified if the browser already has this version.
+ */
+void sendAsset(AsyncWebServerRequest *request, WebAssetId id)
+{
+  const WebAsset &asset = webAssets[id];
+  const AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+
+  AsyncWebServerResponse *response;
+  if (asset.etag.length() > 0 && ifNoneMatch != nullptr && ifNoneMatch->value().indexOf(asset.etag) >= 0)
+  {
+    response = request->beginResponse(304);
+  }
+  else
+  {
+    response = request->beginResponse(SPIFFS, String(asset.path) + ".gz", asset.contentType);
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  if (asset.etag.length() > 0)
+  {
+    response->addHeader("ETag", asset.etag);
+  }
+  response->addHeader("Cache-Control", ASSET_CACHE_CONTROL);
+  request->send(response);
+}
+
 void setupWebServer()
 {
-  // --- Serve static files from SPIFFS ---
+  // --- Serve static files from SPIFFS (gzipped) ---
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
             {
     if (isLockedOut()) {
       request->redirect("/cooldown.html");
     } else {
-      request->send(SPIFFS, "/index.html", "text/html");
+      sendAsset(request, ASSET_INDEX_HTML);
     } });
 
   server.on("/script.js", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/script.js", "text/javascript"); });
+            { sendAsset(request, ASSET_SCRIPT_JS); });
 
   server.on("/admin", HTTP_GET, [](AsyncWebServerRequest *request)
             {  
@@ -145,23 +252,23 @@ void setupWebServer()
     if (!isAdminAuthenticated(request)) {
       return;
     }    
-    request->send(SPIFFS, "/admin.html", "text/html"); });
+    sendAsset(request, ASSET_ADMIN_HTML); });
 
   server.on("/admin.js", HTTP_GET, [](AsyncWebServerRequest *request)
             { 
     if (!isAdminAuthenticated(request)) {
       return;
     }    
-    request->send(SPIFFS, "/admin.js", "text/javascript"); });
+    sendAsset(request, ASSET_ADMIN_JS); });
 
   server.on("/cooldown.html", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/cooldown.html", "text/html"); });
+            { sendAsset(request, ASSET_COOLDOWN_HTML); });
 
   server.on("/cooldown.js", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/cooldown.js", "text/javascript"); });
+            { sendAsset(request, ASSET_COOLDOWN_JS); });
 
   server.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/style.css", "text/css"); });
+            { sendAsset(request, ASSET_STYLE_CSS); });
 
   // --- Handle API Requests ---
   server.on("/login", HTTP_POST, [](AsyncWebServerRequest *request)
@@ -221,15 +328,20 @@ void setupWebServer()
       request->send(400, "text/plain", "Missing required fields.");
     } });
 
-  server.on("/cooldown-time", HTTP_GET, [](AsyncWebServerRequest *request)
-            {
-    Serial.println("[INFO] Cooldown time requested: " + String(remainingLockoutTimeMs) + " ms remaining.");
+  // --- Push State Changes (SSE) ---
+  events.onConnect([](AsyncEventSourceClient *client)
+                   {
+    Serial.printf("[SSE] Client connected (%u open, free heap %u bytes)\n", events.count(), ESP.getFreeHeap());
+    // Current state, also re-sent after the browser reconnects on its own
     if (isLockedOut()) {
-      request->send(200, "text/plain", String(remainingLockoutTimeMs));
-    } else {
-      // Not locked out, send 0
-      request->send(200, "text/plain", "0");
-    } });
+      unsigned long remainingMs = RA_State == LOCKED_OUT ? LOCKOUT_DURATION_MS : remainingLockoutTimeMs;
+      client->send(String(remainingMs).c_str(), "lockout", millis(), SSE_RETRY_MS);
+    } else if (!loginFailTrigger) {
+      // A failed login that is about to start a lockout is still pending otherwise
+      client->send("0", "lockout-end", millis(), SSE_RETRY_MS);
+    }
+    client->send(isDoorOpen() ? "open" : "closed", "door", millis()); });
+  server.addHandler(&events);
 
   // --- Other Paths ---
   server.onNotFound([](AsyncWebServerRequest *request)
@@ -279,6 +391,7 @@ void setup()
     unsigned long total = (unsigned long)SPIFFS.totalBytes();
     unsigned long used = (unsigned long)SPIFFS.usedBytes();
     Serial.printf("SPIFFS total: %lu bytes\nSPIFFS used : %lu bytes\nSPIFFS free : %lu bytes\n", total, used, total - used);
+    loadAssetETags();
   }
 
   // --- LED Setup ---
@@ -412,6 +525,7 @@ void TickFct_RoomAccess()
       remainingLockoutTimeMs = 0;
       RA_State = IDLE;
       Serial.println("[INFO] Locked out cooldown complete.");
+      pushEvent("lockout-end", "0");
     }
     else
     {
@@ -443,6 +557,7 @@ void TickFct_RoomAccess()
 
   case DOOR_OPENING:
     openDoor();
+    pushEvent("door", "open");
     break;
 
   case DOOR_OPEN:
@@ -450,6 +565,7 @@ void TickFct_RoomAccess()
 
   case DOOR_CLOSING:
     closeDoor();
+    pushEvent("door", "closed");
     break;
 
   case FAILED_ATTEMPT:
@@ -462,6 +578,8 @@ void TickFct_RoomAccess()
   case LOCKED_OUT:
     signalFailedAttempt();
     Serial.println("[INFO] Device locked out.");
+    pushEvent("lockout", String(LOCKOUT_DURATION_MS));
+    lastLockoutSyncTime = millis();
     break;
 
   case LOCKED_OUT_WAIT:
@@ -481,4 +599,11 @@ void loop()
     RA_Tick = false;
     TickFct_RoomAccess();
   }
+
+  // --- Lockout Time Sync (SSE) ---
+  if (isLockedOut() && events.count() > 0 && millis() - lastLockoutSyncTime >= LOCKOUT_SYNC_INTERVAL_MS)
+  {
+    lastLockoutSyncTime = millis();
+    pushEvent("remaining", String(remainingLockoutTimeMs));
+  }
 }
\ No newline at end of file
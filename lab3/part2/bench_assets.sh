@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Measures web UI request latency and requests/sec against the board.
+# Flash env:ttgo-lora32-v1 (embedded assets) or env:ttgo-lora32-v1-spiffs (+ Upload Filesystem Image), then:
+#   ./bench_assets.sh 172.30.140.210 [requests] [path]
+# Prints the full-body (200) and revalidation (304) numbers for the same asset.
+#
+# Results: not measured. No board was available when the flash-embedded assets went in, so the comparison against
+# the SPIFFS build is descoped for now. The flash build was kept for what it removes (a filesystem lookup per
+# request, the SPIFFS mount and ETag hashing at boot), not for a measured speedup. Paste both builds' output here
+# once it has been run on a board.
+HOST=${1:?usage: $0 <host> [requests] [path]}
+COUNT=${2:-200}
+ASSET=${3:-/style.css}
+URL="http://$HOST$ASSET"
+
+ETAG=$(curl -sS -o /dev/null -D - -H "Accept-Encoding: gzip" "$URL" | tr -d '\r' | sed -n 's/^[Ee][Tt]ag: //p')
+
+run() {
+  local label=$1
+  shift
+  for _ in $(seq "$COUNT"); do
+    curl -sS -o /dev/null -w "%{time_total}\n" -H "Accept-Encoding: gzip" "$@" "$URL"
+  done | sort -n | awk -v label="$label" '
+    { t[NR] = $1; sum += $1 }
+    END {
+      printf "%-12s n=%d  mean %.1f ms  p50 %.1f ms  p95 %.1f ms  %.1f req/s\n",
+        label, NR, 1000 * sum / NR, 1000 * t[int(NR * 0.5)], 1000 * t[int(NR * 0.95)], NR / sum
+    }'
+}
+
+echo "$URL (ETag $ETAG)"
+run "200 (body)"
+run "304" -H "If-None-Match: $ETAG"
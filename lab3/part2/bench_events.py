@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Measures how many concurrent /events (SSE) clients the board can hold.
+
+Opens connections one by one until one is refused, stalls or gets no initial state,
+then keeps them all open and counts the events each one receives.
+Works against lab3/part1 and lab3/part2:
+
+    ./bench_events.py 172.30.140.210 [max_clients] [hold_seconds]
+
+Trigger a lockout (3 failed logins) or a door opening while it holds, to see the pushes reach every client.
+The board logs "[SSE] Client connected (N open, free heap X bytes)" for each connection.
+
+Results: not measured. No board was available when /events went in, so the maximum number of concurrent clients
+and the free heap at that point are descoped for now. Until then, treat the limit as unknown. It is at most lwIP's
+CONFIG_LWIP_MAX_ACTIVE_TCP (16 by default in ESP-IDF), less the other open sockets, and each client holds a send
+queue on the heap. Record the client
+count and the last logged free heap here for both parts once it has been run on a board.
+"""
+import socket
+import sys
+import time
+
+host = sys.argv[1]
+max_clients = int(sys.argv[2]) if len(sys.argv) > 2 else 32
+hold_seconds = float(sys.argv[3]) if len(sys.argv) > 3 else 30
+TIMEOUT_S = 3
+
+
+def open_client():
+    """Connects and waits for the initial state event, returns (socket, connect time in ms)."""
+    start = time.monotonic()
+    sock = socket.create_connection((host, 80), timeout=TIMEOUT_S)
+    sock.sendall(b"GET /events HTTP/1.1\r\nHost: %s\r\nAccept: text/event-stream\r\n\r\n" % host.encode())
+    received = b""
+    while b"event:" not in received:
+        chunk = sock.recv(1024)
+        if not chunk:
+            raise ConnectionError("closed before the first event")
+        received += chunk
+    return sock, 1000 * (time.monotonic() - start)
+
+
+clients = []
+connect_times = []
+for i in range(max_clients):
+    try:
+        sock, connect_ms = open_client()
+    except (OSError, ConnectionError) as error:
+        print("client %d failed: %s" % (i + 1, error))
+        break
+    clients.append(sock)
+    connect_times.append(connect_ms)
+    print("client %d connected in %.0f ms" % (i + 1, connect_ms))
+
+print("\n%d concurrent clients, holding for %.0f s..." % (len(clients), hold_seconds))
+events = [0] * len(clients)
+deadline = time.monotonic() + hold_seconds
+for sock in clients:
+    sock.settimeout(0.05)
+while time.monotonic() < deadline:
+    for i, sock in enumerate(clients):
+        try:
+            chunk = sock.recv(4096)
+        except socket.timeout:
+            continue
+        except OSError:
+            chunk = b""
+        events[i] += chunk.count(b"event:")
+
+alive = sum(1 for count in events if count > 0)
+if connect_times:
+    print("connect: mean %.0f ms, max %.0f ms" % (sum(connect_times) / len(connect_times), max(connect_times)))
+print("events while holding: min %d, max %d per client (%d clients got at least one)"
+      % (min(events, default=0), max(events, default=0), alive))
+
+for sock in clients:
+    sock.close()
@@ -1,6 +1,7 @@
 document.addEventListener("DOMContentLoaded", () => {
   const timerElement = document.getElementById("timer-message");
   let remainingTimeMs = 0;
+  let timerInterval = null;
 
   /**
    * Formats milliseconds into a MM:SS string.
@@ -18,80 +19,45 @@ document.addEventListener("DOMContentLoaded", () => {
   }
 
   /**
-   * Polls the server to confirm the lockout is *truly* over
-   * before redirecting. This fixes timer drift.
+   * Sets the countdown to the time pushed by the server.
+   * The server re-sends it periodically, so the local timer never drifts far.
    */
-  async function verifyCooldownFinished() {
-    try {
-      const response = await fetch("/cooldown-time");
-      if (!response.ok) {
-        throw new Error("Server error while verifying");
-      }
-
-      const serverTimeMs = parseInt(await response.text(), 10);
-
-      if (serverTimeMs <= 0) {
-        window.location.href = "/";
-      } else {
-        // Client timer was fast. Server is still locked.
-        // Wait 300ms and check again.
-        setTimeout(verifyCooldownFinished, 300);
-      }
-    } catch (error) {
-      console.error("Error verifying cooldown:", error);
-      // Retry after 3 seconds
-      setTimeout(verifyCooldownFinished, 3000);
+  function setRemainingTime(ms) {
+    remainingTimeMs = ms;
+    timerElement.textContent = formatTime(remainingTimeMs);
+    timerElement.className = "";
+
+    if (timerInterval === null) {
+      timerInterval = setInterval(() => {
+        remainingTimeMs = Math.max(0, remainingTimeMs - 1000);
+        timerElement.textContent = formatTime(remainingTimeMs);
+      }, 1000);
     }
   }
 
-  /**
-   * Fetches the initial time and handles the startup race condition.
-   * Then starts the smooth client-side timer.
-   */
-  async function startTimer() {
-    try {
-      let response = await fetch("/cooldown-time");
-      if (!response.ok) throw new Error("Failed to get initial time");
-
-      remainingTimeMs = parseInt(await response.text(), 10);
-
-      if (remainingTimeMs <= 0) {
-        await new Promise((resolve) => setTimeout(resolve, 100)); // 100ms wait
+  // The lockout state is pushed by the server (Server-Sent Events), nothing is polled.
+  // The page only leaves on "lockout-end", so a fast local timer just shows 00:00 until then.
+  const events = new EventSource("/events");
 
-        response = await fetch("/cooldown-time");
-        if (!response.ok) throw new Error("Failed to get retry time");
+  events.addEventListener("lockout", (event) => {
+    setRemainingTime(parseInt(event.data, 10));
+  });
 
-        remainingTimeMs = parseInt(await response.text(), 10);
-      }
+  events.addEventListener("remaining", (event) => {
+    setRemainingTime(parseInt(event.data, 10));
+  });
 
-      if (remainingTimeMs <= 0) {
-        // It's *still* 0. We are genuinely not locked out. Redirect.
-        window.location.href = "/";
-        return;
-      }
+  events.addEventListener("lockout-end", () => {
+    events.close();
+    window.location.href = "/";
+  });
 
-      timerElement.textContent = formatTime(remainingTimeMs);
-
-      const timerInterval = setInterval(() => {
-        remainingTimeMs -= 1000;
-
-        if (remainingTimeMs <= 0) {
-          clearInterval(timerInterval);
-          timerElement.textContent = "00:00";
-
-          // Timer finished, verify with the server to be sure
-          verifyCooldownFinished();
-        } else {
-          // Update the visual timer
-          timerElement.textContent = formatTime(remainingTimeMs);
-        }
-      }, 1000);
-    } catch (error) {
-      console.error("Error starting cooldown timer:", error);
+  events.onerror = () => {
+    // EventSource reconnects on its own, and the server re-sends the state on connect
+    console.error("Lost connection to the server, reconnecting...");
+    if (timerInterval === null) {
       timerElement.textContent = "Error loading timer.";
       timerElement.className = "message-error";
     }
-  }
-
-  startTimer();
+  };
 });
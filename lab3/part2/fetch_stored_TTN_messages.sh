@@ -4,7 +4,10 @@ curl -sS -N -G "https://nam1.cloud.thethings.network/api/v3/as/applications/lab3
   -d "last=12h" \
 | sed -u 's/^data: //' \
 | jq -c 'try .result // . 
-    | {timestamp: .received_at,
-       username: .uplink_message.decoded_payload.username,
-       success: .uplink_message.decoded_payload.success}
+    | .received_at as $received_at
+    | (.uplink_message.decoded_payload | .attempts // [.])[]
+    | {timestamp: $received_at,
+       time_utc: .time_utc,
+       username: .username,
+       success: .success}
     | select(.username != null and .success != null)'
\ No newline at end of file
@@ -0,0 +1,100 @@
+# PlatformIO pre-script: gzips the web UI in data/ and compiles it into include/web_assets.h.
+#  - web_assets.h: one constexpr byte array per asset, with its path, content type, length and ETag
+#    (MD5 of the gzipped body). The server streams these straight from flash.
+#  - data_dir (.pio/data_gz): the same gzipped files, for the SPIFFS build (-DWEB_ASSETS_FROM_SPIFFS).
+# mtime is fixed so an unchanged asset produces the same bytes (and ETag) on every build.
+Import("env")
+
+import gzip
+import hashlib
+import os
+import re
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "text/javascript",
+    ".css": "text/css",
+}
+BYTES_PER_LINE = 16
+
+project_dir = env.subst("$PROJECT_DIR")
+source_dir = os.path.join(project_dir, "data")
+output_dir = env.subst("$PROJECT_DATA_DIR")
+header_path = os.path.join(project_dir, "include", "web_assets.h")
+
+
+def write_if_changed(path, content):
+    if os.path.exists(path):
+        with open(path, "rb") as f:
+            if f.read() == content:
+                return False
+    with open(path, "wb") as f:
+        f.write(content)
+    return True
+
+
+def asset_id(name):
+    return "ASSET_" + re.sub(r"[^A-Z0-9]", "_", name.upper())
+
+
+os.makedirs(output_dir, exist_ok=True)
+
+assets = []
+for name in sorted(os.listdir(source_dir)):
+    source_path = os.path.join(source_dir, name)
+    if not os.path.isfile(source_path):
+        continue
+
+    with open(source_path, "rb") as f:
+        compressed = gzip.compress(f.read(), compresslevel=9, mtime=0)
+    assets.append((name, compressed))
+
+    if write_if_changed(os.path.join(output_dir, name + ".gz"), compressed):
+        print("gzip_assets: %s %d -> %d bytes" % (name, os.path.getsize(source_path), len(compressed)))
+
+# Drop assets that were removed from data/
+expected = set(name + ".gz" for name, _ in assets)
+for name in os.listdir(output_dir):
+    if name not in expected:
+        os.remove(os.path.join(output_dir, name))
+
+lines = [
+    "// Generated by gzip_assets.py from data/. Do not edit.",
+    "#ifndef WEB_ASSETS_H",
+    "#define WEB_ASSETS_H",
+    "",
+    "#include <stddef.h>",
+    "#include <stdint.h>",
+    "",
+    "struct WebAsset",
+    "{",
+    "  const char *path;",
+    "  const char *contentType;",
+    "  const uint8_t *gzipData; // Gzipped body, in flash",
+    "  size_t gzipLength;",
+    "  const char *etag; // Quoted MD5 of the gzipped body",
+    "};",
+    "",
+    "enum WebAssetId",
+    "{",
+]
+lines += ["  %s," % asset_id(name) for name, _ in assets]
+lines += ["  ASSET_COUNT", "};", ""]
+
+for name, compressed in assets:
+    lines.append("constexpr uint8_t %s_GZ[%d] = {" % (asset_id(name), len(compressed)))
+    for i in range(0, len(compressed), BYTES_PER_LINE):
+        chunk = compressed[i:i + BYTES_PER_LINE]
+        lines.append("    " + ", ".join("0x%02x" % b for b in chunk) + ",")
+    lines += ["};", ""]
+
+lines.append("constexpr WebAsset WEB_ASSETS[ASSET_COUNT] = {")
+for name, compressed in assets:
+    content_type = CONTENT_TYPES.get(os.path.splitext(name)[1], "application/octet-stream")
+    etag = hashlib.md5(compressed).hexdigest()
+    lines.append('    {"/%s", "%s", %s_GZ, sizeof(%s_GZ), "\\"%s\\""},'
+                 % (name, content_type, asset_id(name), asset_id(name), etag))
+lines += ["};", "", "#endif", ""]
+
+if write_if_changed(header_path, "\n".join(lines).encode()):
+    print("gzip_assets: wrote %s (%d assets)" % (os.path.relpath(header_path, project_dir), len(assets)))
@@ -0,0 +1,138 @@
+#include "AuditPayload.h"
+
+void writeBits(BitWriter &writer, uint32_t value, uint8_t width)
+{
+    for (int bit = width - 1; bit >= 0; bit--)
+    {
+        uint8_t &byte = writer.buffer[writer.bitCount / 8];
+        uint8_t mask = 0x80 >> (writer.bitCount % 8);
+        byte = (value >> bit) & 1 ? byte | mask : byte & ~mask;
+        writer.bitCount++;
+    }
+}
+
+uint32_t readBits(BitReader &reader, uint8_t width)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < width; i++, reader.position++)
+    {
+        uint8_t bit = (reader.buffer[reader.position / 8] >> (7 - reader.position % 8)) & 1;
+        value = (value << 1) | bit;
+    }
+    return value;
+}
+
+uint16_t hashAuditUsername(const char *username)
+{
+    uint32_t hash = 2166136261UL;
+    for (const char *c = username; *c != '\0'; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619UL;
+    }
+    hash ^= hash >> 16;
+    hash ^= hash >> AUDIT_USER_HASH_BITS;
+    return hash & ((1 << AUDIT_USER_HASH_BITS) - 1);
+}
+
+unsigned getAuditHeaderBitsV2(bool hasBase)
+{
+    return 1 + (hasBase ? AUDIT_BASE_BITS : 0);
+}
+
+unsigned getAuditRecordBitsV2(const LoginAuditRecord &record)
+{
+    if (record.isSystem)
+        return 2 + AUDIT_AGE_BITS;
+    return 3 + (record.isRoomUser ? 0 : AUDIT_USER_HASH_BITS) + AUDIT_AGE_BITS;
+}
+
+void writeAuditRecordV2(BitWriter &writer, const LoginAuditRecord &record, uint32_t referenceTime)
+{
+    uint32_t age = record.timestamp < referenceTime ? referenceTime - record.timestamp : 0;
+    if (age > AUDIT_MAX_AGE)
+        age = AUDIT_MAX_AGE;
+
+    // A lockout is a failed system event
+    writeBits(writer, record.kind == AUDIT_SUCCESS, 1);
+    writeBits(writer, record.isSystem, 1);
+    if (!record.isSystem)
+    {
+        writeBits(writer, record.isRoomUser, 1);
+        if (!record.isRoomUser)
+        {
+            writeBits(writer, record.userHash, AUDIT_USER_HASH_BITS);
+        }
+    }
+    writeBits(writer, age, AUDIT_AGE_BITS);
+}
+
+uint8_t encodeAuditFrameV2(uint8_t *buffer, const LoginAuditRecord *records, uint8_t count, bool hasBase, uint32_t frameTime)
+{
+    BitWriter writer = {buffer, 0};
+    writeBits(writer, hasBase, 1);
+    if (hasBase)
+    {
+        writeBits(writer, frameTime, AUDIT_BASE_BITS);
+    }
+    for (uint8_t i = 0; i < count; i++)
+    {
+        writeAuditRecordV2(writer, records[i], frameTime);
+    }
+
+    // Zero padding up to the byte boundary
+    if (writer.bitCount % 8 != 0)
+    {
+        buffer[writer.bitCount / 8] &= 0xFF << (8 - writer.bitCount % 8);
+    }
+    return (writer.bitCount + 7) / 8;
+}
+
+uint8_t decodeAuditFrameV2(const uint8_t *buffer, uint8_t length, bool &hasBase, uint32_t &base,
+                           DecodedAuditRecord *records, uint8_t maxRecords)
+{
+    BitReader reader = {buffer, length * 8u, 0};
+    if (reader.bitCount == 0)
+        return 0;
+
+    hasBase = readBits(reader, 1);
+    if (hasBase)
+    {
+        if (reader.bitCount - reader.position < AUDIT_BASE_BITS)
+            return 0;
+        base = readBits(reader, AUDIT_BASE_BITS);
+    }
+
+    uint8_t count = 0;
+    // Whatever is left after the last record is zero padding (less than a byte)
+    while (count < maxRecords && reader.bitCount - reader.position >= AUDIT_MIN_RECORD_BITS)
+    {
+        DecodedAuditRecord &record = records[count];
+        bool isSuccess = readBits(reader, 1);
+        record.isSystem = readBits(reader, 1);
+        record.isRoomUser = false;
+        record.userHash = 0;
+        if (record.isSystem)
+        {
+            record.kind = isSuccess ? AUDIT_SUCCESS : AUDIT_LOCKOUT;
+        }
+        else
+        {
+            record.kind = isSuccess ? AUDIT_SUCCESS : AUDIT_FAILURE;
+            if (reader.bitCount - reader.position < 1u + AUDIT_AGE_BITS)
+                break;
+            record.isRoomUser = readBits(reader, 1);
+            if (!record.isRoomUser)
+            {
+                if (reader.bitCount - reader.position < (unsigned)AUDIT_USER_HASH_BITS + AUDIT_AGE_BITS)
+                    break;
+                record.userHash = readBits(reader, AUDIT_USER_HASH_BITS);
+            }
+        }
+        if (reader.bitCount - reader.position < AUDIT_AGE_BITS)
+            break;
+        record.age = readBits(reader, AUDIT_AGE_BITS);
+        count++;
+    }
+    return count;
+}
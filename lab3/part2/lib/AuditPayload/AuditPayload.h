@@ -0,0 +1,97 @@
+#ifndef AUDIT_PAYLOAD_H
+#define AUDIT_PAYLOAD_H
+
+#include <stdint.h>
+
+enum LoginAuditKind
+{
+    AUDIT_FAILURE = 0,
+    AUDIT_SUCCESS = 1,
+    AUDIT_LOCKOUT = 2,
+    AUDIT_KIND_COUNT
+};
+
+const uint8_t AUDIT_USER_HASH_BITS = 12;
+const uint8_t AUDIT_AGE_BITS = 16;
+const uint16_t AUDIT_MAX_AGE = (1UL << AUDIT_AGE_BITS) - 1; // Older records are sent with this age
+const uint8_t AUDIT_BASE_BITS = 32;
+const uint8_t AUDIT_MIN_RECORD_BITS = 2 + AUDIT_AGE_BITS;
+
+// Largest application payload per US915 uplink data rate (LoRaWAN Regional Parameters RP001-1.0.3, DR0-DR4)
+const uint8_t US915_MAX_PAYLOAD[] = {11, 53, 125, 242, 242};
+
+/**
+ * A queued login event, encoded as v1 or v2 when it is sent.
+ */
+struct LoginAuditRecord
+{
+    uint32_t timestamp;
+    uint8_t kind;      // LoginAuditKind
+    bool isSystem;     // Startup/lockout event, not a login attempt
+    bool isRoomUser;   // The attempt named the configured room user
+    uint16_t userHash; // AUDIT_USER_HASH_BITS of FNV-1a over the full username
+    char username[8];  // Truncated, for v1
+};
+
+/**
+ * A v2 record as the network side sees it: an age instead of a timestamp, and no username.
+ */
+struct DecodedAuditRecord
+{
+    uint8_t kind; // LoginAuditKind
+    bool isSystem;
+    bool isRoomUser;
+    uint16_t userHash; // Only set when the attempt didn't name the room user
+    uint16_t age;      // Seconds before the frame's reference time, AUDIT_MAX_AGE when capped
+};
+
+// Audit Payload v2 (fPort 2), decoded by payload-formatter/LoginAttempt.js.
+// A bit stream, most significant bit first, zero-padded to a whole byte:
+//   hasBase:1 [base:32]  then per record:  success:1 system:1 [roomUser:1 [userHash:12]] age:16
+// age is the seconds between the event and the frame's reference time: the base (device Unix time when the frame
+// was built) when present, otherwise the network's receive time.
+// A system record is the startup message (success) or a lockout (fail).
+
+struct BitWriter
+{
+    uint8_t *buffer;
+    unsigned bitCount;
+};
+
+struct BitReader
+{
+    const uint8_t *buffer;
+    unsigned bitCount; // Bits available
+    unsigned position;
+};
+
+void writeBits(BitWriter &writer, uint32_t value, uint8_t width);
+uint32_t readBits(BitReader &reader, uint8_t width);
+
+/**
+ * Hashes a username down to AUDIT_USER_HASH_BITS (FNV-1a, xor-folded), as the decoder side can recompute.
+ */
+uint16_t hashAuditUsername(const char *username);
+
+unsigned getAuditHeaderBitsV2(bool hasBase);
+unsigned getAuditRecordBitsV2(const LoginAuditRecord &record);
+
+void writeAuditRecordV2(BitWriter &writer, const LoginAuditRecord &record, uint32_t referenceTime);
+
+/**
+ * Encodes a v2 frame.
+ * @param buffer Receives the frame, must hold the header and all records.
+ * @param frameTime Device Unix time the ages count back from, and the base if hasBase is set.
+ * @returns Frame length in bytes.
+ */
+uint8_t encodeAuditFrameV2(uint8_t *buffer, const LoginAuditRecord *records, uint8_t count, bool hasBase, uint32_t frameTime);
+
+/**
+ * Decodes a v2 frame, stopping at the padding or after maxRecords.
+ * @param base Set to the frame's base time when hasBase comes back true.
+ * @returns Number of records decoded.
+ */
+uint8_t decodeAuditFrameV2(const uint8_t *buffer, uint8_t length, bool &hasBase, uint32_t &base,
+                           DecodedAuditRecord *records, uint8_t maxRecords);
+
+#endif
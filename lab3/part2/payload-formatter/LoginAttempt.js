@@ -1,30 +1,160 @@
-function decodeUplink(input) {
-  var data = {};
+// v1 (fPort 1): one or more 13-byte login records (the device aggregates queued attempts)
+// v2 (fPort 2): bit-packed records with ages instead of timestamps, see lib/AuditPayload/AuditPayload.h
+var V2_PORT = 2;
+var RECORD_SIZE = 13;
+var RESULTS = ["fail", "success", "lockout"];
+var USER_HASH_BITS = 12;
+var AGE_BITS = 16;
+var MIN_V2_RECORD_BITS = 2 + AGE_BITS;
+
+function decodeRecord(bytes, offset) {
+  var record = {};
 
   // Decode Timestamp (4 bytes, little-endian)
   var timestamp_raw =
-    input.bytes[0] |
-    (input.bytes[1] << 8) |
-    (input.bytes[2] << 16) |
-    (input.bytes[3] << 24);
-  data.unix_time = timestamp_raw;
+    (bytes[offset] |
+      (bytes[offset + 1] << 8) |
+      (bytes[offset + 2] << 16) |
+      (bytes[offset + 3] << 24)) >>>
+    0;
+  record.unix_time = timestamp_raw;
   // Convert Unix timestamp to a human-readable ISO string
-  data.time_utc = new Date(timestamp_raw * 1000).toISOString();
+  record.time_utc = new Date(timestamp_raw * 1000).toISOString();
 
-  // Decode Success (1 byte)
-  data.success_raw = input.bytes[4];
-  data.success = data.success_raw === 1 ? "success" : "fail";
+  // Decode Success (1 byte): 0 = fail, 1 = success, 2 = lockout started
+  record.success_raw = bytes[offset + 4];
+  record.success = RESULTS[record.success_raw] || "fail";
 
   // Decode Username (8 bytes)
-  var username_bytes = input.bytes.slice(5, 13);
+  var username_bytes = bytes.slice(offset + 5, offset + RECORD_SIZE);
   // Convert byte array to string and trim any null characters
-  data.username = String.fromCharCode
+  record.username = String.fromCharCode
     .apply(null, username_bytes)
     .replace(/\0/g, "");
 
+  return record;
+}
+
+/**
+ * The 12-bit hash the device sends for usernames other than the room user
+ * (FNV-1a, xor-folded), to match v2 records against known names.
+ */
+function usernameHash(username) {
+  var hash = 2166136261;
+  for (var i = 0; i < username.length; i++) {
+    hash = Math.imul(hash ^ (username.charCodeAt(i) & 0xff), 16777619) >>> 0;
+  }
+  hash = (hash ^ (hash >>> 16)) >>> 0;
+  hash = hash ^ (hash >>> USER_HASH_BITS);
+  return hash & ((1 << USER_HASH_BITS) - 1);
+}
+
+function decodeV2(input) {
+  var bytes = input.bytes;
+  var position = 0;
+  var readBits = function (width) {
+    var value = 0;
+    for (var i = 0; i < width; i++, position++) {
+      var bit = (bytes[position >> 3] >> (7 - (position & 7))) & 1;
+      value = value * 2 + bit;
+    }
+    return value;
+  };
+
+  var warnings = [];
+  var data = {};
+  var reference_time;
+  if (readBits(1)) {
+    data.base_time = readBits(32);
+    reference_time = data.base_time;
+  } else if (input.recvTime) {
+    // No base in this frame: ages count back from the network's receive time
+    reference_time = Math.floor(new Date(input.recvTime).getTime() / 1000);
+  } else {
+    warnings.push("No base time or receive time, only ages are decoded");
+  }
+
+  var attempts = [];
+  // Whatever is left after the last record is zero padding (less than a byte)
+  while (bytes.length * 8 - position >= MIN_V2_RECORD_BITS) {
+    var record = {};
+    var success = readBits(1);
+    var system = readBits(1);
+    if (system) {
+      // A failed system event is a lockout
+      record.success_raw = success ? 1 : 2;
+      record.username = "system";
+    } else {
+      record.success_raw = success;
+      if (readBits(1)) {
+        record.username = "room_user";
+      } else {
+        record.user_hash = readBits(USER_HASH_BITS);
+        record.username = "#" + record.user_hash.toString(16);
+      }
+    }
+    record.success = RESULTS[record.success_raw];
+    record.age_s = readBits(AGE_BITS);
+    if (record.age_s === Math.pow(2, AGE_BITS) - 1) {
+      // The device caps the age, the event is at least this old
+      record.age_capped = true;
+    }
+    if (reference_time !== undefined) {
+      record.unix_time = reference_time - record.age_s;
+      record.time_utc = new Date(record.unix_time * 1000).toISOString();
+    }
+    attempts.push(record);
+  }
+  if (attempts.length === 0) {
+    return { data: {}, warnings: warnings, errors: ["Payload too short"] };
+  }
+
+  // Same shape as v1: the first record at the top level, all of them in "attempts"
+  for (var key in attempts[0]) {
+    data[key] = attempts[0][key];
+  }
+  data.version = 2;
+  data.attempts = attempts;
+
+  return {
+    data: data,
+    warnings: warnings,
+    errors: [],
+  };
+}
+
+function decodeUplink(input) {
+  if (input.fPort === V2_PORT) {
+    return decodeV2(input);
+  }
+
+  var warnings = [];
+  var attempts = [];
+
+  for (
+    var offset = 0;
+    offset + RECORD_SIZE <= input.bytes.length;
+    offset += RECORD_SIZE
+  ) {
+    attempts.push(decodeRecord(input.bytes, offset));
+  }
+  if (input.bytes.length % RECORD_SIZE !== 0) {
+    warnings.push(
+      "Ignored " + (input.bytes.length % RECORD_SIZE) + " trailing byte(s)",
+    );
+  }
+  if (attempts.length === 0) {
+    return { data: {}, warnings: warnings, errors: ["Payload too short"] };
+  }
+
+  // The first record stays at the top level, for consumers of single-record uplinks
+  var data = decodeRecord(input.bytes, 0);
+  data.version = 1;
+  data.attempts = attempts;
+
   return {
     data: data,
-    warnings: [],
+    warnings: warnings,
     errors: [],
   };
 }
@@ -1,6 +1,11 @@
 #include <Arduino.h>
+#if defined(WEB_ASSETS_FROM_SPIFFS)
 #include <SPIFFS.h>
+#endif
 #include <time.h>
+#include <atomic>
+#include <esp_timer.h>
+#include <driver/adc.h>
 #include <WiFi.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
@@ -8,8 +13,11 @@
 #include <lmic.h>
 #include <hal/hal.h>
 #include <SPI.h>
+#include <Preferences.h>
+#include <AuditPayload.h>
 
 #include "credentials.h"
+#include "web_assets.h"
 
 // --- WiFi Credentials ---
 const char *SSID = WIFI_SSID;
@@ -40,6 +48,15 @@ const lmic_pinmap lmic_pins = {
 const unsigned char PORT = 80;
 AsyncWebServer server(PORT);
 
+// --- Server-Sent Events ---
+// Lockout and door changes are pushed to the pages on /events instead of being polled.
+// Events: "lockout" (start, data = remaining ms), "remaining" (ms, every LOCKOUT_SYNC_INTERVAL_MS),
+// "lockout-end", and "door" ("open" / "closed"). A page gets the current state when it connects.
+AsyncEventSource events("/events");
+const unsigned long SSE_RETRY_MS = 3000;               // Browser reconnect delay after a lost connection
+const unsigned long LOCKOUT_SYNC_INTERVAL_MS = 10000; // Re-sends the remaining time so page timers don't drift
+unsigned long lastLockoutSyncTime = 0;
+
 // --- Servo Configuration ---
 Servo servo;
 const unsigned char SERVO_TIMER_ID = 0;
@@ -54,42 +71,72 @@ const unsigned short SERVO_DOOR_OPEN_POS = 90;  // Degrees
 // --- Distance Sensor Variables ---
 // Sharp GP2Y0A02 datasheet: https://global.sharp/products/device/lineup/data/pdf/datasheet/gp2y0a02yk_e.pdf
 // ESP32 ADC Docs: https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/peripherals/adc/index.html
-const int ADC_MAX = 4095;                        // ESP32 12-bit ADC
-const float ADC_VREF = 3.3;                      // ESP32 ADC reference voltage
-const int PROX_NUM_READINGS = 10;                // Number of samples for averaging
-const int PROX_READING_DELAY_US = 50000;         // 50ms delay between samples
-const unsigned long PROX_READ_INTERVAL_MS = 500; // Read sensor every 500ms
-
-const float PROXIMITY_THRESHOLD_CM = 50.0; // If distance < this, someone is "nearby"
-const float VOLTAGE_MIN_FOR_RANGE = 0.40;  // Corresponds to ~150cm. Below this is "out of range"
-const float VOLTAGE_MAX_FOR_RANGE = 2.80;  // Corresponds to ~15-20cm. Above this is "very close"
-
-int proxReadings[PROX_NUM_READINGS];
-int proxReadingIndex = 0;
-long proxReadingTotal = 0;
-unsigned long lastProxSampleTimeUs = 0;
-
-unsigned long lastProxReadTime = 0;
+// The ADC samples continuously into DMA buffers (ADC1 only, through I2S0 on the ESP32), nothing calls analogRead().
+// Each DMA frame is averaged, and the reading is the median of the last PROX_MEDIAN_FRAMES frame means:
+// the mean smooths the sensor's ripple, the median drops frames hit by an IR glint or a supply spike.
+const int ADC_MAX = 4095;                                    // ESP32 12-bit ADC
+constexpr float ADC_VREF = 3.3;                              // ESP32 ADC reference voltage
+const adc1_channel_t PROXIMITY_ADC_CHANNEL = ADC1_CHANNEL_6; // PROXIMITY_DATA_PIN (GPIO 34)
+const uint32_t PROX_SAMPLE_RATE_HZ = 20000;                  // Lowest rate of the ESP32's DMA mode
+const int PROX_FRAME_SAMPLES = 512;                          // Samples per DMA frame (25.6 ms)
+const int PROX_DMA_BUFFER_FRAMES = 4;                        // Frames the driver holds if loop() falls behind
+const int PROX_MEDIAN_FRAMES = 5;                            // Median window, in frames (128 ms)
+
+const float PROXIMITY_THRESHOLD_CM = 50.0;    // If distance < this, someone is "nearby"
+constexpr float VOLTAGE_MIN_FOR_RANGE = 0.40; // Corresponds to ~150cm. Below this is "out of range"
+constexpr float VOLTAGE_MAX_FOR_RANGE = 2.80; // Corresponds to ~15-20cm. Above this is "very close"
+
+int proxFrameMeans[PROX_MEDIAN_FRAMES];
+int proxFrameIndex = 0;
+int proxFrameCount = 0;
+volatile int proxFilteredRaw = 0;
+
 float currentDistanceCm = -1.0; // -1.0 for unknown/out of range
 volatile bool isPersonNearby = false;
 
 // --- Login & Lockout Logic Variables ---
-volatile int incorrectAttempts = 0;
+// Global lockout policy: MAX_FAILED_ATTEMPTS bad logins from anyone lock the door for everyone.
+// Independent of the per-client rate limiting below, and can be turned off on its own.
+const bool USE_GLOBAL_LOCKOUT = true;
+int incorrectAttempts = 0;
 const unsigned char MAX_FAILED_ATTEMPTS = 3;
 const unsigned long LOCKOUT_DURATION_MS = 2 * 60 * 1000; // 2 minutes
 const unsigned long DOOR_OPEN_DURATION_MS = 5000;        // 5 seconds
 const unsigned long LED_ON_DURATION_MS = 2000;           // 2 seconds
-volatile unsigned long remainingLockoutTimeMs = 0;
+
+// --- Per-Client Login Rate Limiting ---
+// Each source IP gets a token bucket: LOGIN_BUCKET_CAPACITY attempts at once, refilled at one per LOGIN_REFILL_INTERVAL_MS.
+// Buckets live in a fixed-size open-addressing table (linear probing). Nothing is ever removed, so once the table is
+// full a new client takes over the least recently seen client's slot. An empty bucket is answered with 429 before the
+// credentials are compared or anything is logged over LoRa.
+const unsigned char LOGIN_BUCKET_CAPACITY = 5;
+const unsigned long LOGIN_REFILL_INTERVAL_MS = 10000; // 10 seconds
+const unsigned char RATE_LIMIT_TABLE_BITS = 5;        // 32 clients
+const unsigned char RATE_LIMIT_TABLE_SIZE = 1 << RATE_LIMIT_TABLE_BITS;
+
+struct LoginBucket
+{
+  uint32_t ip;
+  bool isUsed;
+  unsigned char tokens;
+  unsigned long lastRefillMs;
+  unsigned long lastSeenMs;
+};
+
+LoginBucket loginBuckets[RATE_LIMIT_TABLE_SIZE];
+unsigned long rateLimitedCount = 0;
 
 // --- State Machine and Timer Variables ---
-hw_timer_t *RA_Timer = NULL;
-const unsigned char RA_TIMER_ID = 1;
-const unsigned short RA_PERIOD_US = 1000;                // Timer period in microseconds (1000us = 1ms)
-const unsigned short RA_PERIOD_MS = RA_PERIOD_US / 1000; // Period in milliseconds
+// The state machine only runs on a login event or on the one deadline it is waiting for. A one-shot
+// esp_timer is armed for that deadline, nothing ticks in between (it used to run every 1 ms).
+// The pass-through states (DOOR_OPENING, DOOR_CLOSING, FAILED_ATTEMPT, LOCKED_OUT) still last RA_STEP_MS, one tick
+// of the old timer, and deadlines are anchored to the previous deadline, so all timings are the same as before.
+esp_timer_handle_t RA_Timer = NULL;
+const unsigned long RA_STEP_MS = 1;
 volatile bool RA_Tick = false;
-bool RA_TimerEnabled = false;
+int64_t stateDeadlineUs = 0; // esp_timer time at which the current state times out, 0 while IDLE
 
-void IRAM_ATTR RA_TimerISR()
+void RA_TimerCallback(void *arg)
 {
   RA_Tick = true;
 }
@@ -107,10 +154,74 @@ enum RA_States
 };
 
 RA_States RA_State = IDLE;
-unsigned long stateTimer = 0;
 
-volatile bool loginSuccessTrigger = false;
-volatile bool loginFailTrigger = false;
+// --- Login Event Queue ---
+// The /login handler (AsyncTCP task) only checks the credentials and queues a typed event, with the paused request as
+// its reply handle. The state machine (loop()) is the only owner of the room-access state: it takes one event per
+// IDLE tick (and refuses them all while locked out), commits the transition, then answers the request.
+// Single producer (the AsyncTCP task), single consumer (loop()): a lock-free ring with acquire/release indices.
+enum LoginEventType
+{
+  LOGIN_VALID_CREDENTIALS,
+  LOGIN_INVALID_CREDENTIALS
+};
+
+struct LoginEvent
+{
+  LoginEventType type;
+  String username;
+  bool isRoomUser;                // The username matched, for the audit log
+  AsyncWebServerRequestPtr reply; // Paused request, expires if the client goes away
+};
+
+const unsigned char LOGIN_EVENT_QUEUE_BITS = 3;
+const unsigned char LOGIN_EVENT_QUEUE_SIZE = 1 << LOGIN_EVENT_QUEUE_BITS; // 8 pending logins, more get a 503
+
+LoginEvent loginEvents[LOGIN_EVENT_QUEUE_SIZE];
+std::atomic<uint32_t> loginEventHead(0); // Next slot to write, only moved by the producer
+std::atomic<uint32_t> loginEventTail(0); // Next slot to read, only moved by the consumer
+
+bool isLoginEventQueueFull()
+{
+  return loginEventHead.load(std::memory_order_relaxed) - loginEventTail.load(std::memory_order_acquire) >= LOGIN_EVENT_QUEUE_SIZE;
+}
+
+bool hasLoginEvent()
+{
+  return loginEventHead.load(std::memory_order_acquire) != loginEventTail.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Queues a login event. Producer side only.
+ * @return False if the queue is full, the event is left untouched.
+ */
+bool pushLoginEvent(LoginEvent &event)
+{
+  if (isLoginEventQueueFull())
+    return false;
+
+  uint32_t head = loginEventHead.load(std::memory_order_relaxed);
+  loginEvents[head & (LOGIN_EVENT_QUEUE_SIZE - 1)] = std::move(event);
+  // Publish the slot only once it is written
+  loginEventHead.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Takes the oldest login event. Consumer side only.
+ * @return False if there is none.
+ */
+bool popLoginEvent(LoginEvent &event)
+{
+  if (!hasLoginEvent())
+    return false;
+
+  uint32_t tail = loginEventTail.load(std::memory_order_relaxed);
+  event = std::move(loginEvents[tail & (LOGIN_EVENT_QUEUE_SIZE - 1)]);
+  // Hand the slot back only once it is read
+  loginEventTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
 
 // --- NTP (Time) Configuration ---
 const char *ntpServer = "pool.ntp.org";
@@ -128,17 +239,59 @@ void os_getDevEui(u1_t *buf) { memcpy_P(buf, DEVEUI, 8); }
 static const u1_t PROGMEM APPKEY[16] = APP_KEY;
 void os_getDevKey(u1_t *buf) { memcpy_P(buf, APPKEY, 16); }
 
-struct LoRaLogPayload
+// v1 uplink record (fPort 1), 13 bytes on the wire (see payload-formatter/LoginAttempt.js)
+struct __attribute__((packed)) LoRaLogPayload
 {
   uint32_t timestamp; // 4 bytes for Unix time
-  uint8_t success;    // 1 byte (0 = fail, 1 = success)
+  uint8_t success;    // 1 byte (0 = fail, 1 = success, 2 = lockout started)
   char username[8];   // 8 bytes for a truncated username
 };
 
-static uint8_t mydata[] = "Hello, world!";
 static osjob_t sendjob;
 
-const unsigned TX_INTERVAL = 60; // in seconds
+const unsigned TX_INTERVAL = 60; // in seconds, minimum time between two audit uplinks
+
+// --- Login Audit Uplink Queue ---
+// Login attempts are queued instead of being dropped while LMIC is busy. Each uplink packs as many queued records as
+// the current data rate allows, failures and lockouts first, then successes (oldest first within each).
+// Uplinks are at least TX_INTERVAL apart, on top of the duty cycle LMIC enforces, so bursts end up in one frame.
+// When the queue is full the oldest success is dropped (the oldest record if there is none), and counted.
+const unsigned char AUDIT_QUEUE_SIZE = 32;
+const unsigned char MAX_LORA_PAYLOAD = 242;
+
+// --- Audit Payload v2 (fPort 2) ---
+// Bit-packed records with ages instead of timestamps, see lib/AuditPayload/AuditPayload.h for the layout.
+// The base time goes out on the first uplink and then every AUDIT_BASE_INTERVAL_S, so the device clock can be
+// checked against the network's.
+// 19 bits for a room-user attempt instead of 104. Time on air with 13 bytes of LoRaWAN overhead, 125 kHz, CR 4/5:
+//   records   v1 bytes  v2 bytes   SF10 (DR0)      SF9 (DR1)       SF8 (DR2)       SF7 (DR3)
+//   1         13        3          412 -> 330 ms   206 -> 165 ms   113 -> 93 ms    62 -> 52 ms
+//   4         52        10         739 -> 371 ms   390 -> 206 ms   216 -> 113 ms   123 -> 62 ms
+// A v1 record doesn't even fit the 11 bytes of DR0, v2 carries up to 4 there.
+const bool USE_AUDIT_PAYLOAD_V2 = true;
+const uint8_t AUDIT_V1_PORT = 1;
+const uint8_t AUDIT_V2_PORT = 2;
+const unsigned long AUDIT_BASE_INTERVAL_S = 3600;
+
+// Optional: keep the queue in NVS so a reset doesn't lose it. Off by default to spare flash writes.
+const bool USE_AUDIT_FLASH_BACKUP = false;
+const unsigned long AUDIT_PERSIST_INTERVAL_MS = 10000; // At most one NVS write per interval, only when changed
+// Stored next to the records. Bump it whenever LoginAuditRecord changes, so a blob saved by older firmware is
+// discarded instead of being misread. Blobs from before the version was stored read as 0.
+const uint8_t AUDIT_QUEUE_LAYOUT = 1;
+
+LoginAuditRecord auditQueue[AUDIT_QUEUE_SIZE]; // In arrival order
+unsigned char auditQueueCount = 0;
+unsigned long auditDroppedCount[AUDIT_KIND_COUNT] = {0};
+unsigned long auditSentCount = 0;
+unsigned long auditUplinkCount = 0;
+unsigned long lastAuditUplinkTime = 0;
+bool hasSentAuditUplink = false;
+uint32_t lastAuditBaseTime = 0;
+bool hasSentAuditBase = false;
+bool isAuditQueueDirty = false;
+unsigned long lastAuditPersistTime = 0;
+Preferences auditPreferences;
 
 void printHex2(unsigned v)
 {
@@ -148,41 +301,236 @@ void printHex2(unsigned v)
   Serial.print(v, HEX);
 }
 
+bool isHighPriority(const LoginAuditRecord &record)
+{
+  return record.kind != AUDIT_SUCCESS;
+}
+
 /**
- * @brief Prepares and queues a structured login attempt payload for LoRaWAN.
- * @param username The username string from the login attempt.
- * @param isSuccess True if the login was successful, false otherwise.
+ * @brief Queues a login audit record for the next LoRaWAN uplink.
+ * @param username The username string from the login attempt (truncated to 7 characters for v1).
+ * @param kind Failure, success or lockout.
+ * @param isSystem True for device events (startup, lockout) rather than login attempts.
+ * @param isRoomUser True if the attempt named the configured room user.
  */
-void sendLoginAttemptLog(String username, bool isSuccess)
+void queueLoginAudit(const String &username, LoginAuditKind kind, bool isSystem = false, bool isRoomUser = false)
 {
-  // Check if LoRaWAN is busy
-  if (LMIC.opmode & OP_TXRXPEND)
+  LoginAuditRecord record;
+
+  // Get current time
+  time_t now;
+  time(&now);
+  record.timestamp = (uint32_t)now;
+  record.kind = kind;
+  record.isSystem = isSystem;
+  record.isRoomUser = isRoomUser;
+  record.userHash = hashAuditUsername(username.c_str());
+
+  // Clear the buffer with nulls, copy up to 7 chars to leave room for a null terminator
+  memset(record.username, 0, sizeof(record.username));
+  strncpy(record.username, username.c_str(), sizeof(record.username) - 1);
+
+  int droppedKind = -1;
+  if (auditQueueCount == AUDIT_QUEUE_SIZE)
   {
-    Serial.println(F("OP_TXRXPEND, not sending login log"));
-    return;
+    // Make room: the oldest success, otherwise the oldest record
+    unsigned char victim = 0;
+    for (unsigned char i = 0; i < auditQueueCount; i++)
+    {
+      if (!isHighPriority(auditQueue[i]))
+      {
+        victim = i;
+        break;
+      }
+    }
+    droppedKind = auditQueue[victim].kind;
+    auditDroppedCount[droppedKind]++;
+    memmove(&auditQueue[victim], &auditQueue[victim + 1], (auditQueueCount - victim - 1) * sizeof(LoginAuditRecord));
+    auditQueueCount--;
+  }
+  auditQueue[auditQueueCount++] = record;
+  isAuditQueueDirty = true;
+
+  if (droppedKind >= 0)
+  {
+    Serial.printf("[WARN] Audit queue full, dropped the oldest %s record.\n", droppedKind == AUDIT_SUCCESS ? "success" : "failure/lockout");
   }
+  Serial.printf("[INFO] Login log queued: User=%s, Success=%d, Time=%u (%u queued)\n",
+                record.username, record.kind, record.timestamp, auditQueueCount);
+}
+
+/**
+ * @brief Queues a login attempt for the LoRaWAN audit trail.
+ * @param event The login event, for its username.
+ * @param isSuccess True if the login was successful, false otherwise.
+ */
+void sendLoginAttemptLog(const LoginEvent &event, bool isSuccess)
+{
+  queueLoginAudit(event.username, isSuccess ? AUDIT_SUCCESS : AUDIT_FAILURE, false, event.isRoomUser);
+}
 
+unsigned char getMaxAuditPayload()
+{
+  unsigned char dr = LMIC.datarate;
+  return dr < sizeof(US915_MAX_PAYLOAD) ? US915_MAX_PAYLOAD[dr] : US915_MAX_PAYLOAD[0];
+}
+
+unsigned getAuditRecordBits(const LoginAuditRecord &record)
+{
+  if (!USE_AUDIT_PAYLOAD_V2)
+    return sizeof(LoRaLogPayload) * 8;
+  return getAuditRecordBitsV2(record);
+}
+
+void writeAuditRecordV1(uint8_t *buffer, const LoginAuditRecord &record)
+{
   LoRaLogPayload payload;
+  payload.timestamp = record.timestamp;
+  payload.success = record.kind;
+  memcpy(payload.username, record.username, sizeof(payload.username));
+  memcpy(buffer, &payload, sizeof(payload));
+}
+
+/**
+ * @brief Sends the next aggregated audit uplink once LMIC is free and TX_INTERVAL has passed.
+ */
+void serviceAuditUplink()
+{
+  if (auditQueueCount == 0)
+    return;
+  // Busy with a frame, or a frame (e.g. the join's first uplink) is still waiting to go out
+  if (LMIC.opmode & (OP_TXRXPEND | OP_TXDATA))
+    return;
+  if (hasSentAuditUplink && millis() - lastAuditUplinkTime < TX_INTERVAL * 1000UL)
+    return;
 
-  // Get current time
   time_t now;
   time(&now);
-  payload.timestamp = (uint32_t)now;
+  uint32_t frameTime = (uint32_t)now;
+  bool hasBase = USE_AUDIT_PAYLOAD_V2 && (!hasSentAuditBase || frameTime - lastAuditBaseTime >= AUDIT_BASE_INTERVAL_S);
+  unsigned headerBits = USE_AUDIT_PAYLOAD_V2 ? getAuditHeaderBitsV2(hasBase) : 0;
+  unsigned bitBudget = getMaxAuditPayload() * 8;
+  unsigned usedBits = headerBits;
+
+  LoginAuditRecord picked[AUDIT_QUEUE_SIZE];
+  unsigned char pickedCount = 0;
 
-  // Set success status
-  payload.success = isSuccess ? 1 : 0;
+  // High priority first, then successes, oldest first within each
+  for (int pass = 0; pass < 2; pass++)
+  {
+    unsigned char kept = 0;
+    for (unsigned char i = 0; i < auditQueueCount; i++)
+    {
+      unsigned recordBits = getAuditRecordBits(auditQueue[i]);
+      // Always take at least one record. If it doesn't fit, LMIC refuses it and the data rate may go up
+      bool isPicked = isHighPriority(auditQueue[i]) == (pass == 0) &&
+                      (usedBits + recordBits <= bitBudget || pickedCount == 0);
+      if (isPicked)
+      {
+        picked[pickedCount++] = auditQueue[i];
+        usedBits += recordBits;
+      }
+      else
+      {
+        auditQueue[kept++] = auditQueue[i];
+      }
+    }
+    auditQueueCount = kept;
+  }
+  isAuditQueueDirty = true;
 
-  // Set username (and truncate)
-  // Clear the buffer with nulls
-  memset(payload.username, 0, sizeof(payload.username));
-  // Copy up to 7 chars to leave room for a null terminator
-  strncpy(payload.username, username.c_str(), sizeof(payload.username) - 1);
+  lastAuditUplinkTime = millis();
+  hasSentAuditUplink = true;
 
-  // Queue the packet
-  LMIC_setTxData2(1, (uint8_t *)&payload, sizeof(payload), 0);
+  uint8_t buffer[MAX_LORA_PAYLOAD + sizeof(LoRaLogPayload)] = {0};
+  uint8_t length;
+  if (USE_AUDIT_PAYLOAD_V2)
+  {
+    length = encodeAuditFrameV2(buffer, picked, pickedCount, hasBase, frameTime);
+  }
+  else
+  {
+    for (unsigned char i = 0; i < pickedCount; i++)
+    {
+      writeAuditRecordV1(&buffer[i * sizeof(LoRaLogPayload)], picked[i]);
+    }
+    length = pickedCount * sizeof(LoRaLogPayload);
+  }
 
-  Serial.printf("[INFO] Login log queued: User=%s, Success=%d, Time=%u\n",
-                payload.username, payload.success, payload.timestamp);
+  lmic_tx_error_t error = LMIC_setTxData2(USE_AUDIT_PAYLOAD_V2 ? AUDIT_V2_PORT : AUDIT_V1_PORT, buffer, length, 0);
+  if (error != LMIC_ERROR_SUCCESS)
+  {
+    // Put them back in front for the next try, as far as there is room
+    unsigned char restored = min((int)pickedCount, AUDIT_QUEUE_SIZE - auditQueueCount);
+    memmove(&auditQueue[restored], &auditQueue[0], auditQueueCount * sizeof(LoginAuditRecord));
+    memcpy(&auditQueue[0], picked, restored * sizeof(LoginAuditRecord));
+    auditQueueCount += restored;
+    for (unsigned char i = restored; i < pickedCount; i++)
+    {
+      auditDroppedCount[picked[i].kind]++;
+    }
+    Serial.printf("[WARN] Audit uplink of %u records refused by LMIC (error %d), retrying later.\n", pickedCount, error);
+    return;
+  }
+
+  if (hasBase)
+  {
+    lastAuditBaseTime = frameTime;
+    hasSentAuditBase = true;
+  }
+  auditSentCount += pickedCount;
+  auditUplinkCount++;
+  Serial.printf("[INFO] Audit uplink queued: %u records (%u bytes, v%d), %u still waiting.\n",
+                pickedCount, length, USE_AUDIT_PAYLOAD_V2 ? 2 : 1, auditQueueCount);
+}
+
+/**
+ * @brief Writes the queue to NVS when it changed, at most once per AUDIT_PERSIST_INTERVAL_MS.
+ */
+void persistAuditQueue()
+{
+  if (!USE_AUDIT_FLASH_BACKUP || !isAuditQueueDirty || millis() - lastAuditPersistTime < AUDIT_PERSIST_INTERVAL_MS)
+    return;
+
+  if (auditQueueCount == 0)
+  {
+    // putBytes() writes nothing for an empty blob, the delivered records would come back after a reset
+    auditPreferences.remove("records");
+  }
+  else
+  {
+    auditPreferences.putUChar("layout", AUDIT_QUEUE_LAYOUT);
+    auditPreferences.putBytes("records", auditQueue, auditQueueCount * sizeof(LoginAuditRecord));
+  }
+  isAuditQueueDirty = false;
+  lastAuditPersistTime = millis();
+}
+
+void restoreAuditQueue()
+{
+  if (!USE_AUDIT_FLASH_BACKUP)
+    return;
+
+  auditPreferences.begin("audit", false);
+  if (!auditPreferences.isKey("records"))
+    return;
+
+  size_t storedLength = auditPreferences.getBytesLength("records");
+  uint8_t layout = auditPreferences.getUChar("layout", 0);
+  if (layout != AUDIT_QUEUE_LAYOUT || storedLength % sizeof(LoginAuditRecord) != 0 || storedLength > sizeof(auditQueue))
+  {
+    Serial.printf("[WARN] Discarding stored audit queue (layout %u, %u bytes), it doesn't match this firmware.\n",
+                  layout, (unsigned)storedLength);
+    auditPreferences.remove("records");
+    return;
+  }
+
+  size_t length = auditPreferences.getBytes("records", auditQueue, sizeof(auditQueue));
+  auditQueueCount = length / sizeof(LoginAuditRecord);
+  if (auditQueueCount > 0)
+  {
+    Serial.printf("[INFO] Restored %u queued audit records from flash.\n", auditQueueCount);
+  }
 }
 
 void onEvent(ev_t ev)
@@ -371,12 +719,163 @@ bool isLockedOut()
   return RA_State == LOCKED_OUT || RA_State == LOCKED_OUT_WAIT;
 }
 
+/**
+ * @brief Finds the client's bucket, or claims one (an empty slot, else the least recently seen client's).
+ */
+LoginBucket &findLoginBucket(uint32_t ip, unsigned long now)
+{
+  // Fibonacci hashing spreads neighbouring addresses over the table
+  unsigned char start = (uint32_t)(ip * 2654435761u) >> (32 - RATE_LIMIT_TABLE_BITS);
+  unsigned char oldest = start;
+
+  for (unsigned char probe = 0; probe < RATE_LIMIT_TABLE_SIZE; probe++)
+  {
+    unsigned char slot = (start + probe) & (RATE_LIMIT_TABLE_SIZE - 1);
+    LoginBucket &bucket = loginBuckets[slot];
+
+    if (bucket.isUsed && bucket.ip == ip)
+    {
+      return bucket;
+    }
+    if (!bucket.isUsed)
+    {
+      oldest = slot;
+      break;
+    }
+    if (now - bucket.lastSeenMs > now - loginBuckets[oldest].lastSeenMs)
+    {
+      oldest = slot;
+    }
+  }
+
+  // Empty slot on the probe path, or the table is full and every slot is on it
+  LoginBucket &bucket = loginBuckets[oldest];
+  bucket.ip = ip;
+  bucket.isUsed = true;
+  bucket.tokens = LOGIN_BUCKET_CAPACITY;
+  bucket.lastRefillMs = now;
+  return bucket;
+}
+
+/**
+ * @brief Takes one login attempt from the client's bucket.
+ * @param retryAfterMs Set to the time until the next token when the attempt is refused.
+ * @return True if the attempt may go ahead.
+ */
+bool takeLoginToken(uint32_t ip, unsigned long &retryAfterMs)
+{
+  unsigned long now = millis();
+  LoginBucket &bucket = findLoginBucket(ip, now);
+  bucket.lastSeenMs = now;
+
+  unsigned long refills = (now - bucket.lastRefillMs) / LOGIN_REFILL_INTERVAL_MS;
+  if (refills > 0)
+  {
+    bucket.tokens = min((unsigned long)LOGIN_BUCKET_CAPACITY, bucket.tokens + refills);
+    bucket.lastRefillMs += refills * LOGIN_REFILL_INTERVAL_MS;
+  }
+
+  if (bucket.tokens == 0)
+  {
+    retryAfterMs = LOGIN_REFILL_INTERVAL_MS - (now - bucket.lastRefillMs);
+    return false;
+  }
+
+  if (bucket.tokens == LOGIN_BUCKET_CAPACITY)
+  {
+    // A full bucket doesn't bank time, the next token is a whole interval after this attempt
+    bucket.lastRefillMs = now;
+  }
+  bucket.tokens--;
+  return true;
+}
+
+/**
+ * @brief Arms the one-shot alarm for the current state's timeout.
+ * @param enteredUs When the state was entered: the previous deadline, or the trigger time when leaving IDLE.
+ * @param durationMs How long the state lasts.
+ */
+void RA_SetTimeout(int64_t enteredUs, unsigned long durationMs)
+{
+  stateDeadlineUs = enteredUs + (int64_t)durationMs * 1000;
+  int64_t delayUs = stateDeadlineUs - esp_timer_get_time();
+
+  esp_timer_stop(RA_Timer); // Not running is fine
+  esp_timer_start_once(RA_Timer, delayUs > 0 ? delayUs : 0);
+}
+
+bool isDoorOpen()
+{
+  return RA_State == DOOR_OPENING || RA_State == DOOR_OPEN;
+}
+
+/**
+ * @brief Time left in the lockout, rounded up to the millisecond (0 if not locked out).
+ */
+unsigned long getRemainingLockoutMs()
+{
+  if (RA_State == LOCKED_OUT)
+  {
+    return LOCKOUT_DURATION_MS;
+  }
+  if (RA_State != LOCKED_OUT_WAIT)
+  {
+    return 0;
+  }
+
+  int64_t remainingUs = stateDeadlineUs - esp_timer_get_time();
+  return remainingUs > 0 ? (unsigned long)((remainingUs + 999) / 1000) : 0;
+}
+
+/**
+ * @brief Pushes an event to every page connected to /events.
+ */
+void pushEvent(const char *event, const String &data)
+{
+  events.send(data.c_str(), event, millis());
+}
+
+// --- Static Web Assets ---
+// gzip_assets.py compiles data/ into web_assets.h at build time: gzipped bodies as constexpr arrays, with the
+// content type, length and ETag (MD5 of the gzipped body) precomputed. Requests are answered straight from
+// flash with no filesystem lookup. Build with -DWEB_ASSETS_FROM_SPIFFS (env:ttgo-lora32-v1-spiffs) to serve the
+// same gzipped files from SPIFFS instead, for comparison.
+// "no-cache" still revalidates every load (a 304 with no body): "/" depends on the lockout state.
+const char *ASSET_CACHE_CONTROL = "no-cache";
+
+/**
+ * @brief Sends a gzipped asset, or 304 Not Modified if the browser already has this version.
+ */
+void sendAsset(AsyncWebServerRequest *request, WebAssetId id)
+{
+  const WebAsset &asset = WEB_ASSETS[id];
+  const AsyncWebHeader *ifNoneMatch = request->getHeader("If-None-Match");
+
+  AsyncWebServerResponse *response;
+  if (ifNoneMatch != nullptr && ifNoneMatch->value().indexOf(asset.etag) >= 0)
+  {
+    response = request->beginResponse(304);
+  }
+  else
+  {
+#if defined(WEB_ASSETS_FROM_SPIFFS)
+    response = request->beginResponse(SPIFFS, String(asset.path) + ".gz", asset.contentType);
+#else
+    response = request->beginResponse(200, asset.contentType, asset.gzipData, asset.gzipLength);
+#endif
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", ASSET_CACHE_CONTROL);
+  request->send(response);
+}
+
 /**
  * @brief Converts a raw ADC value (0-4095) to a voltage (0-3.3V).
  * @param rawValue The raw ADC value.
  * @return The corresponding voltage.
  */
-float rawToVoltage(int rawValue)
+constexpr float rawToVoltage(int rawValue)
 {
   return (rawValue / (float)ADC_MAX) * ADC_VREF;
 }
@@ -389,7 +888,7 @@ float rawToVoltage(int rawValue)
  * @param voltage The sensor output voltage.
  * @return Distance in cm, or -1.0 if out of the reliable range.
  */
-float voltageToDistanceCm(float voltage)
+constexpr float voltageToDistanceCm(float voltage)
 {
   if (voltage < VOLTAGE_MIN_FOR_RANGE)
   {
@@ -412,19 +911,146 @@ float voltageToDistanceCm(float voltage)
   return distance;
 }
 
+// --- Raw ADC to Distance Table ---
+// voltageToDistanceCm() for every raw value, evaluated at compile time. 0 means out of range.
+struct ProxDistanceTable
+{
+  uint8_t cm[ADC_MAX + 1];
+};
+
+constexpr ProxDistanceTable makeProxDistanceTable()
+{
+  ProxDistanceTable table = {};
+  for (int raw = 0; raw <= ADC_MAX; raw++)
+  {
+    float distance = voltageToDistanceCm(rawToVoltage(raw));
+    table.cm[raw] = distance < 0 ? 0 : (uint8_t)(distance + 0.5f);
+  }
+  return table;
+}
+
+constexpr ProxDistanceTable PROX_DISTANCE_TABLE = makeProxDistanceTable(); // 4 KB, in flash
+
+/**
+ * @brief Converts a raw ADC value to distance in cm with a table lookup.
+ * @return Distance in cm, or -1.0 if out of the reliable range.
+ */
+float rawToDistanceCm(int rawValue)
+{
+  uint8_t cm = PROX_DISTANCE_TABLE.cm[constrain(rawValue, 0, ADC_MAX)];
+  return cm == 0 ? -1.0 : cm;
+}
+
+/**
+ * @brief Starts continuous DMA sampling of the proximity sensor.
+ */
+void initProximityAdc()
+{
+  adc_digi_init_config_t initConfig = {};
+  initConfig.max_store_buf_size = PROX_DMA_BUFFER_FRAMES * PROX_FRAME_SAMPLES * sizeof(adc_digi_output_data_t);
+  initConfig.conv_num_each_intr = PROX_FRAME_SAMPLES * sizeof(adc_digi_output_data_t);
+  initConfig.adc1_chan_mask = BIT(PROXIMITY_ADC_CHANNEL);
+  initConfig.adc2_chan_mask = 0;
+  ESP_ERROR_CHECK(adc_digi_initialize(&initConfig));
+
+  // Same attenuation as analogRead(), so raw values keep the 0-3.3V scale
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_11;
+  pattern.channel = PROXIMITY_ADC_CHANNEL;
+  pattern.unit = 0; // ADC1
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = true; // Required on the ESP32
+  config.conv_limit_num = 250;
+  config.pattern_num = 1;
+  config.adc_pattern = &pattern;
+  config.sample_freq_hz = PROX_SAMPLE_RATE_HZ;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  ESP_ERROR_CHECK(adc_digi_controller_configure(&config));
+  ESP_ERROR_CHECK(adc_digi_start());
+}
+
+/**
+ * @brief Median of the frame means collected so far (at most PROX_MEDIAN_FRAMES).
+ */
+int getProxMedian()
+{
+  int sorted[PROX_MEDIAN_FRAMES];
+  memcpy(sorted, proxFrameMeans, proxFrameCount * sizeof(int));
+  // Insertion sort, the window is tiny
+  for (int i = 1; i < proxFrameCount; i++)
+  {
+    int value = sorted[i];
+    int j = i - 1;
+    for (; j >= 0 && sorted[j] > value; j--)
+    {
+      sorted[j + 1] = sorted[j];
+    }
+    sorted[j + 1] = value;
+  }
+  return sorted[proxFrameCount / 2];
+}
+
+/**
+ * @brief Filters every DMA frame that is ready and updates the distance and the nearby flag. Never blocks.
+ */
+void serviceProximitySampling()
+{
+  static adc_digi_output_data_t frame[PROX_FRAME_SAMPLES];
+  uint32_t length = 0;
+
+  // ESP_ERR_INVALID_STATE means the driver's buffer overflowed, what it returns is still valid
+  esp_err_t result;
+  while ((result = adc_digi_read_bytes((uint8_t *)frame, sizeof(frame), &length, 0)) == ESP_OK ||
+         result == ESP_ERR_INVALID_STATE)
+  {
+    uint32_t total = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < length / sizeof(adc_digi_output_data_t); i++)
+    {
+      if (frame[i].type1.channel == PROXIMITY_ADC_CHANNEL)
+      {
+        total += frame[i].type1.data;
+        count++;
+      }
+    }
+    if (count == 0)
+      continue;
+
+    proxFrameMeans[proxFrameIndex] = total / count;
+    proxFrameIndex = (proxFrameIndex + 1) % PROX_MEDIAN_FRAMES;
+    if (proxFrameCount < PROX_MEDIAN_FRAMES)
+    {
+      proxFrameCount++;
+    }
+
+    proxFilteredRaw = getProxMedian();
+    currentDistanceCm = rawToDistanceCm(proxFilteredRaw);
+
+    // Update the nearby flag
+    isPersonNearby = currentDistanceCm > 0 && currentDistanceCm < PROXIMITY_THRESHOLD_CM;
+
+    // Uncomment for debugging
+    // Serial.printf("Frame mean: %d (%u samples), Median: %d, Dist: %.1fcm, Nearby: %s\n",
+    //               total / count, count, proxFilteredRaw, currentDistanceCm, isPersonNearby ? "YES" : "NO");
+  }
+}
+
 void setupWebServer()
 {
-  // --- Serve static files from SPIFFS ---
+  // --- Serve static files (gzipped, from flash or SPIFFS) ---
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
             {
     if (isLockedOut()) {
       request->redirect("/cooldown.html");
     } else {
-      request->send(SPIFFS, "/index.html", "text/html");
+      sendAsset(request, ASSET_INDEX_HTML);
     } });
 
   server.on("/script.js", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/script.js", "text/javascript"); });
+            { sendAsset(request, ASSET_SCRIPT_JS); });
 
   server.on("/admin", HTTP_GET, [](AsyncWebServerRequest *request)
             {  
@@ -432,72 +1058,69 @@ void setupWebServer()
     if (!isAdminAuthenticated(request)) {
       return;
     }    
-    request->send(SPIFFS, "/admin.html", "text/html"); });
+    sendAsset(request, ASSET_ADMIN_HTML); });
 
   server.on("/admin.js", HTTP_GET, [](AsyncWebServerRequest *request)
             { 
     if (!isAdminAuthenticated(request)) {
       return;
     }    
-    request->send(SPIFFS, "/admin.js", "text/javascript"); });
+    sendAsset(request, ASSET_ADMIN_JS); });
 
   server.on("/cooldown.html", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/cooldown.html", "text/html"); });
+            { sendAsset(request, ASSET_COOLDOWN_HTML); });
 
   server.on("/cooldown.js", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/cooldown.js", "text/javascript"); });
+            { sendAsset(request, ASSET_COOLDOWN_JS); });
 
   server.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/style.css", "text/css"); });
+            { sendAsset(request, ASSET_STYLE_CSS); });
 
   // --- Handle API Requests ---
   server.on("/login", HTTP_POST, [](AsyncWebServerRequest *request)
             {
+    // Per-client rate limit first, a flood is refused before any other work
+    IPAddress clientIp = request->client()->remoteIP();
+    unsigned long retryAfterMs = 0;
+    if (!takeLoginToken((uint32_t)clientIp, retryAfterMs)) {
+      rateLimitedCount++;
+      Serial.printf("[RATE] 429 for %s (%lu rate-limited so far)\n", clientIp.toString().c_str(), rateLimitedCount);
+      AsyncWebServerResponse *response = request->beginResponse(429, "text/plain", "Too many login attempts. Please wait.");
+      response->addHeader("Retry-After", String((retryAfterMs + 999) / 1000));
+      request->send(response);
+      return;
+    }
+
     Serial.println("\n[INFO] Login attempt received.");
-    // Calculate the current average raw value from the total
-    int avgRaw = proxReadingTotal / PROX_NUM_READINGS;
-    // Print the sensor's current state
+    // Print the sensor's current state (median-filtered raw value)
+    int filteredRaw = proxFilteredRaw;
     Serial.printf("[INFO] Proximity Data | Raw: %d, Volt: %.2fV, Dist: %.1fcm, Nearby: %s\n",
-                  avgRaw,
-                  rawToVoltage(avgRaw),
+                  filteredRaw,
+                  rawToVoltage(filteredRaw),
                   currentDistanceCm,
                   isPersonNearby ? "YES" : "NO");
     
-    if (isLockedOut()) {
-      request->send(403, "text/plain", "Locked out. Try again later.");
+    if (!request->hasParam("USERNAME", true) || !request->hasParam("PASSWORD", true)) {
+      request->send(400, "text/plain", "Missing username or password.");
       return;
     }
 
-    if (request->hasParam("USERNAME", true) && request->hasParam("PASSWORD", true)) {
-      String user = request->getParam("USERNAME", true)->value();
-      String pass = request->getParam("PASSWORD", true)->value();
-
-      if (user == roomUsername && pass == roomPassword) {
-        loginSuccessTrigger = true;
-        if (isPersonNearby) {
-          // REQ: Correct creds + Person detected
-          request->send(200, "text/plain", "Login Successful! Door opening.");
-          sendLoginAttemptLog(user, true);
-        } else {
-          // REQ: Correct creds + NO Person
-          request->send(401, "text/plain", "Login successful, but no person detected. Please stand closer.");
-          sendLoginAttemptLog(user, false);
-        }
-      } else {
-        loginFailTrigger = true;
-        sendLoginAttemptLog(user, false);
-        
-        int attemptsLeft = MAX_FAILED_ATTEMPTS - (incorrectAttempts + 1);
-        if (attemptsLeft <= 0) {
-          request->send(403, "text/plain", String(MAX_FAILED_ATTEMPTS) + " failed attempts. Locked out for " + String(LOCKOUT_DURATION_MS / (60 * 1000)) +" minutes.");
-        } else {
-          String msg = "Invalid credentials. " + String(attemptsLeft) + " attempt(s) remaining.";
-          request->send(401, "text/plain", msg);
-        }
-      }
-    } else {
-      request->send(400, "text/plain", "Missing username or password.");
-    } });
+    // Only this task pushes, so a queue that isn't full now still has room below
+    if (isLoginEventQueueFull()) {
+      AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Too many pending logins. Please retry.");
+      response->addHeader("Retry-After", "1");
+      request->send(response);
+      return;
+    }
+
+    // The state machine decides and replies (see replyToLoginEvent)
+    LoginEvent event;
+    event.username = request->getParam("USERNAME", true)->value();
+    String pass = request->getParam("PASSWORD", true)->value();
+    event.isRoomUser = event.username == roomUsername;
+    event.type = event.isRoomUser && pass == roomPassword ? LOGIN_VALID_CREDENTIALS : LOGIN_INVALID_CREDENTIALS;
+    event.reply = request->pause();
+    pushLoginEvent(event); });
 
   server.on("/update-credentials", HTTP_POST, [](AsyncWebServerRequest *request)
             {
@@ -527,15 +1150,33 @@ void setupWebServer()
       request->send(400, "text/plain", "Missing required fields.");
     } });
 
-  server.on("/cooldown-time", HTTP_GET, [](AsyncWebServerRequest *request)
+  server.on("/audit-stats", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    Serial.println("[INFO] Cooldown time requested: " + String(remainingLockoutTimeMs) + " ms remaining.");
+    if (!isAdminAuthenticated(request)) {
+      return;
+    }
+
+    String json = "{\"queued\":" + String(auditQueueCount) +
+                  ",\"sent\":" + String(auditSentCount) +
+                  ",\"uplinks\":" + String(auditUplinkCount) +
+                  ",\"dropped\":{\"failure\":" + String(auditDroppedCount[AUDIT_FAILURE]) +
+                  ",\"success\":" + String(auditDroppedCount[AUDIT_SUCCESS]) +
+                  ",\"lockout\":" + String(auditDroppedCount[AUDIT_LOCKOUT]) + "}}";
+    request->send(200, "application/json", json); });
+
+  // --- Push State Changes (SSE) ---
+  events.onConnect([](AsyncEventSourceClient *client)
+                   {
+    Serial.printf("[SSE] Client connected (%u open, free heap %u bytes)\n", events.count(), ESP.getFreeHeap());
+    // Current state, also re-sent after the browser reconnects on its own
     if (isLockedOut()) {
-      request->send(200, "text/plain", String(remainingLockoutTimeMs));
+      client->send(String(getRemainingLockoutMs()).c_str(), "lockout", millis(), SSE_RETRY_MS);
     } else {
-      // Not locked out, send 0
-      request->send(200, "text/plain", "0");
-    } });
+      // The lockout reply is only sent once the lockout is committed, so a redirected page never sees it pending
+      client->send("0", "lockout-end", millis(), SSE_RETRY_MS);
+    }
+    client->send(isDoorOpen() ? "open" : "closed", "door", millis()); });
+  server.addHandler(&events);
 
   // --- Other Paths ---
   server.onNotFound([](AsyncWebServerRequest *request)
@@ -545,24 +1186,6 @@ void setupWebServer()
   Serial.println(String("HTTP server started: Accessible at http://") + WiFi.localIP().toString() + ":" + String(PORT));
 }
 
-void enableTimer(hw_timer_t *timer, bool &isEnabledFlag)
-{
-  if (!isEnabledFlag)
-  {
-    timerAlarmEnable(timer);
-    isEnabledFlag = true;
-  }
-}
-
-void disableTimer(hw_timer_t *timer, bool &isEnabledFlag)
-{
-  if (isEnabledFlag)
-  {
-    timerAlarmDisable(timer);
-    isEnabledFlag = false;
-  }
-}
-
 void closeDoor();
 
 void setup()
@@ -574,6 +1197,7 @@ void setup()
     delay(10);
   }
 
+#if defined(WEB_ASSETS_FROM_SPIFFS)
   // --- Initialize SPIFFS ---
   if (!SPIFFS.begin(true))
   {
@@ -586,6 +1210,7 @@ void setup()
     unsigned long used = (unsigned long)SPIFFS.usedBytes();
     Serial.printf("SPIFFS total: %lu bytes\nSPIFFS used : %lu bytes\nSPIFFS free : %lu bytes\n", total, used, total - used);
   }
+#endif
 
   // --- LED Setup ---
   pinMode(GREEN_LED_PIN, OUTPUT);
@@ -598,11 +1223,7 @@ void setup()
 
   // --- Proximity Sensor Setup ---
   pinMode(PROXIMITY_DATA_PIN, INPUT);
-  // Initialize rolling average array
-  for (int i = 0; i < PROX_NUM_READINGS; i++)
-  {
-    proxReadings[i] = 0;
-  }
+  initProximityAdc();
 
   connectToWifi();
   initNTP();
@@ -612,20 +1233,18 @@ void setup()
   // --- LoRaWAN Setup ---
   os_init();    // LMIC init
   LMIC_reset(); // Reset the MAC state. Session and pending data transfers will be discarded.
+  restoreAuditQueue();
   Serial.println("[INFO] Queuing LoRaWAN startup message...");
-  sendLoginAttemptLog("system", true);
+  queueLoginAudit("system", AUDIT_SUCCESS, true);
 
   closeDoor(); // Ensure door is closed at startup
 
-  // Initialize State Machine Timer ---
-  // Specify Timer ID, prescaler 80 (for 1MHz, 1us ticks), count up.
-  RA_Timer = timerBegin(RA_TIMER_ID, 80, true);
-  // Attach the ISR to the timer
-  timerAttachInterrupt(RA_Timer, &RA_TimerISR, true);
-  // Set alarm to trigger every PERIOD, and auto-reload
-  timerAlarmWrite(RA_Timer, RA_PERIOD_US, true);
-  // Start the timer's alarm
-  enableTimer(RA_Timer, RA_TimerEnabled);
+  // --- Initialize State Machine Timer ---
+  // One-shot, armed by RA_SetTimeout() for the next deadline only
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = &RA_TimerCallback;
+  timerArgs.name = "room_access";
+  esp_timer_create(&timerArgs, &RA_Timer);
 
   // Serial.println("Heap Memory After Setup:");
   // Serial.printf("Free Heap: %u bytes, Max Contiguous Block: %u bytes\n", esp_get_free_heap_size(), heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
@@ -660,15 +1279,83 @@ void clearLEDIndicators()
   digitalWrite(RED_LED_PIN, LOW);
 }
 
+/**
+ * @brief Answers a login request, if the client is still there.
+ */
+void sendLoginReply(LoginEvent &event, int code, const String &message)
+{
+  if (auto request = event.reply.lock())
+  {
+    request->send(code, "text/plain", message);
+  }
+}
+
+/**
+ * @brief Answers a login event from the state the state machine just committed to, and logs it.
+ */
+void replyToLoginEvent(LoginEvent &event)
+{
+  if (event.type == LOGIN_VALID_CREDENTIALS)
+  {
+    if (RA_State == DOOR_OPENING)
+    {
+      // REQ: Correct creds + Person detected
+      sendLoginReply(event, 200, "Login Successful! Door opening.");
+      sendLoginAttemptLog(event, true);
+    }
+    else
+    {
+      // REQ: Correct creds + NO Person
+      sendLoginReply(event, 401, "Login successful, but no person detected. Please stand closer.");
+      sendLoginAttemptLog(event, false);
+    }
+    return;
+  }
+
+  sendLoginAttemptLog(event, false);
+  if (!USE_GLOBAL_LOCKOUT)
+  {
+    sendLoginReply(event, 401, "Invalid credentials.");
+  }
+  else if (RA_State == LOCKED_OUT)
+  {
+    sendLoginReply(event, 403, String(MAX_FAILED_ATTEMPTS) + " failed attempts. Locked out for " + String(LOCKOUT_DURATION_MS / (60 * 1000)) + " minutes.");
+  }
+  else
+  {
+    int attemptsLeft = MAX_FAILED_ATTEMPTS - incorrectAttempts;
+    sendLoginReply(event, 401, "Invalid credentials. " + String(attemptsLeft) + " attempt(s) remaining.");
+  }
+}
+
 void TickFct_RoomAccess()
 {
+  LoginEvent event;
+  bool hasEvent = false;
+
+  // Logins while locked out are refused as they come, they don't change the state
+  while (isLockedOut() && popLoginEvent(event))
+  {
+    sendLoginReply(event, 403, "Locked out. Try again later.");
+  }
+
+  int64_t nowUs = esp_timer_get_time();
+  // Every state but IDLE only moves on at its deadline
+  if (RA_State != IDLE && nowUs < stateDeadlineUs)
+  {
+    return;
+  }
+  // The state being left ended at its deadline, the next one starts there
+  int64_t enteredUs = stateDeadlineUs;
+
   // --- State Transitions ---
   switch (RA_State)
   {
   case IDLE:
-    if (loginSuccessTrigger)
+    enteredUs = nowUs;
+    hasEvent = popLoginEvent(event);
+    if (hasEvent && event.type == LOGIN_VALID_CREDENTIALS)
     {
-      loginSuccessTrigger = false;
       incorrectAttempts = 0;
 
       if (isPersonNearby)
@@ -683,12 +1370,11 @@ void TickFct_RoomAccess()
         RA_State = FAILED_ATTEMPT;
       }
     }
-    else if (loginFailTrigger)
+    else if (hasEvent)
     {
-      loginFailTrigger = false;
       incorrectAttempts++;
 
-      if (incorrectAttempts >= MAX_FAILED_ATTEMPTS)
+      if (USE_GLOBAL_LOCKOUT && incorrectAttempts >= MAX_FAILED_ATTEMPTS)
       {
         RA_State = LOCKED_OUT;
       }
@@ -701,17 +1387,12 @@ void TickFct_RoomAccess()
     break;
 
   case DOOR_OPENING:
-    stateTimer = 0;
     RA_State = DOOR_OPEN;
     break;
 
   case DOOR_OPEN:
-    stateTimer += RA_PERIOD_MS;
-    if (stateTimer >= DOOR_OPEN_DURATION_MS)
-    {
-      Serial.println("[INFO] Door open duration elapsed.");
-      RA_State = DOOR_CLOSING;
-    }
+    Serial.println("[INFO] Door open duration elapsed.");
+    RA_State = DOOR_CLOSING;
     break;
 
   case DOOR_CLOSING:
@@ -719,37 +1400,22 @@ void TickFct_RoomAccess()
     break;
 
   case FAILED_ATTEMPT:
-    stateTimer = 0;
     RA_State = FAILED_COOLDOWN;
     break;
 
   case FAILED_COOLDOWN:
-    stateTimer += RA_PERIOD_MS;
-    if (stateTimer >= LED_ON_DURATION_MS)
-    {
-      RA_State = IDLE;
-    }
+    RA_State = IDLE;
     break;
 
   case LOCKED_OUT:
     incorrectAttempts = 0; // Reset counter
-    stateTimer = 0;
-    remainingLockoutTimeMs = LOCKOUT_DURATION_MS;
     RA_State = LOCKED_OUT_WAIT;
     break;
 
   case LOCKED_OUT_WAIT:
-    stateTimer += RA_PERIOD_MS;
-    if (stateTimer >= LOCKOUT_DURATION_MS)
-    {
-      remainingLockoutTimeMs = 0;
-      RA_State = IDLE;
-      Serial.println("[INFO] Locked out cooldown complete.");
-    }
-    else
-    {
-      remainingLockoutTimeMs = LOCKOUT_DURATION_MS - stateTimer;
-    }
+    RA_State = IDLE;
+    Serial.println("[INFO] Locked out cooldown complete.");
+    pushEvent("lockout-end", "0");
     break;
 
   default:
@@ -757,16 +1423,35 @@ void TickFct_RoomAccess()
     break;
   }
 
-  // --- State Actions ---
+  // --- State Timeouts ---
   switch (RA_State)
   {
   case IDLE:
-    // Clear remaining time just in case
-    if (remainingLockoutTimeMs > 0)
-    {
-      remainingLockoutTimeMs = 0;
-    }
+    stateDeadlineUs = 0;
+    break;
+
+  case DOOR_OPEN:
+    RA_SetTimeout(enteredUs, DOOR_OPEN_DURATION_MS);
+    break;
+
+  case FAILED_COOLDOWN:
+    RA_SetTimeout(enteredUs, LED_ON_DURATION_MS);
+    break;
 
+  case LOCKED_OUT_WAIT:
+    RA_SetTimeout(enteredUs, LOCKOUT_DURATION_MS);
+    break;
+
+  default:
+    // Pass-through states
+    RA_SetTimeout(enteredUs, RA_STEP_MS);
+    break;
+  }
+
+  // --- State Actions ---
+  switch (RA_State)
+  {
+  case IDLE:
     // If we just entered IDLE from a cooldown, turn off the light
     if (digitalRead(RED_LED_PIN) == HIGH || digitalRead(GREEN_LED_PIN) == HIGH)
     {
@@ -776,6 +1461,7 @@ void TickFct_RoomAccess()
 
   case DOOR_OPENING:
     openDoor();
+    pushEvent("door", "open");
     break;
 
   case DOOR_OPEN:
@@ -783,6 +1469,7 @@ void TickFct_RoomAccess()
 
   case DOOR_CLOSING:
     closeDoor();
+    pushEvent("door", "closed");
     break;
 
   case FAILED_ATTEMPT:
@@ -795,6 +1482,9 @@ void TickFct_RoomAccess()
   case LOCKED_OUT:
     signalFailedAttempt();
     Serial.println("[INFO] Device locked out.");
+    pushEvent("lockout", String(LOCKOUT_DURATION_MS));
+    lastLockoutSyncTime = millis();
+    queueLoginAudit("system", AUDIT_LOCKOUT, true);
     break;
 
   case LOCKED_OUT_WAIT:
@@ -804,71 +1494,38 @@ void TickFct_RoomAccess()
     Serial.println("[ERROR] Unknown state action!");
     break;
   }
+
+  // --- Login Reply ---
+  // Only now that the transition is committed
+  if (hasEvent)
+  {
+    replyToLoginEvent(event);
+  }
 }
 
 void loop()
 {
   os_runloop_once();
 
-  // --- Non-blocking state machine tick ---
-  if (RA_Tick)
+  // --- Login Audit Uplinks (LoRaWAN) ---
+  serviceAuditUplink();
+  persistAuditQueue();
+
+  // --- Event-driven state machine: login events (while IDLE or locked out) and deadlines ---
+  bool hasPendingLogin = (RA_State == IDLE || isLockedOut()) && hasLoginEvent();
+  if (RA_Tick || hasPendingLogin)
   {
     RA_Tick = false;
     TickFct_RoomAccess();
   }
 
-  // --- Non-blocking Proximity Sampling ---
-  if (micros() - lastProxSampleTimeUs >= PROX_READING_DELAY_US)
-  {
-    lastProxSampleTimeUs = micros();
-
-    // Subtract the oldest reading from the total
-    proxReadingTotal -= proxReadings[proxReadingIndex];
-
-    // Take a new reading and add it to the total
-    int newReading = analogRead(PROXIMITY_DATA_PIN);
-    proxReadings[proxReadingIndex] = newReading;
-    proxReadingTotal += newReading;
-
-    proxReadingIndex++;
-    // Wrap around the index if needed
-    if (proxReadingIndex >= PROX_NUM_READINGS)
-    {
-      proxReadingIndex = 0;
-    }
-  }
+  // --- Proximity Filtering (DMA frames) ---
+  serviceProximitySampling();
 
-  // --- Non-blocking Proximity Calculation ---
-  if (millis() - lastProxReadTime >= PROX_READ_INTERVAL_MS)
+  // --- Lockout Time Sync (SSE) ---
+  if (isLockedOut() && events.count() > 0 && millis() - lastLockoutSyncTime >= LOCKOUT_SYNC_INTERVAL_MS)
   {
-    lastProxReadTime = millis();
-
-    // Calculate the average from the rolling total
-    int avgRaw = proxReadingTotal / PROX_NUM_READINGS;
-
-    float voltage = rawToVoltage(avgRaw);
-    currentDistanceCm = voltageToDistanceCm(voltage);
-
-    // Update the nearby flag
-    if (currentDistanceCm > 0 && currentDistanceCm < PROXIMITY_THRESHOLD_CM)
-    {
-      isPersonNearby = true;
-    }
-    else
-    {
-      isPersonNearby = false;
-    }
-
-    // Uncomment for debugging
-    // Serial.printf("Raw: %d, Volt: %.2fV, Dist: %.1fcm, Nearby: %s\n",
-    //               avgRaw, voltage, currentDistanceCm, isPersonNearby ? "YES" : "NO");
-    // Serial.print("proxReadings: [");
-    // for (int i = 0; i < PROX_NUM_READINGS; ++i)
-    // {
-    //   Serial.print(proxReadings[i]);
-    //   if (i < PROX_NUM_READINGS - 1)
-    //     Serial.print(", ");
-    // }
-    // Serial.println("]");
+    lastLockoutSyncTime = millis();
+    pushEvent("remaining", String(getRemainingLockoutMs()));
   }
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include <unity.h>
+#include <string.h>
+#include "AuditPayload.h"
+
+static const uint32_t FRAME_TIME = 1792310400;
+
+static LoginAuditRecord record(uint8_t kind, bool isSystem, bool isRoomUser, const char *username, uint32_t age)
+{
+    LoginAuditRecord r;
+    memset(&r, 0, sizeof(r));
+    r.timestamp = FRAME_TIME - age;
+    r.kind = kind;
+    r.isSystem = isSystem;
+    r.isRoomUser = isRoomUser;
+    r.userHash = hashAuditUsername(username);
+    strncpy(r.username, username, sizeof(r.username) - 1);
+    return r;
+}
+
+static uint8_t buffer[256];
+static DecodedAuditRecord decoded[32];
+
+void setUp()
+{
+    // Garbage, so missing padding or unwritten bits show up
+    memset(buffer, 0xA5, sizeof(buffer));
+    memset(decoded, 0, sizeof(decoded));
+}
+
+void tearDown()
+{
+}
+
+void test_hash_matches_decoder()
+{
+    // usernameHash() in payload-formatter/LoginAttempt.js
+    TEST_ASSERT_EQUAL_UINT16(0xE5C, hashAuditUsername("admin"));
+    TEST_ASSERT_EQUAL_UINT16(0xE7A, hashAuditUsername("mallory"));
+}
+
+void test_frame_with_base()
+{
+    LoginAuditRecord records[] = {record(AUDIT_SUCCESS, false, true, "admin", 42)};
+    uint8_t length = encodeAuditFrameV2(buffer, records, 1, true, FRAME_TIME);
+    TEST_ASSERT_EQUAL_UINT8((33 + 19 + 7) / 8, length);
+
+    bool hasBase = false;
+    uint32_t base = 0;
+    TEST_ASSERT_EQUAL_UINT8(1, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_TRUE(hasBase);
+    TEST_ASSERT_EQUAL_UINT32(FRAME_TIME, base);
+    TEST_ASSERT_EQUAL_UINT16(42, decoded[0].age);
+}
+
+void test_frame_without_base()
+{
+    LoginAuditRecord records[] = {record(AUDIT_FAILURE, false, true, "admin", 7)};
+    uint8_t length = encodeAuditFrameV2(buffer, records, 1, false, FRAME_TIME);
+    TEST_ASSERT_EQUAL_UINT8(3, length);
+
+    // 20 bits used, the last 4 are zero padding
+    TEST_ASSERT_EQUAL_UINT8(0, buffer[2] & 0x0F);
+
+    bool hasBase = true;
+    uint32_t base = 0;
+    TEST_ASSERT_EQUAL_UINT8(1, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_FALSE(hasBase);
+    TEST_ASSERT_EQUAL_UINT8(AUDIT_FAILURE, decoded[0].kind);
+    TEST_ASSERT_EQUAL_UINT16(7, decoded[0].age);
+}
+
+void test_room_user_record()
+{
+    LoginAuditRecord records[] = {record(AUDIT_SUCCESS, false, true, "admin", 5)};
+    TEST_ASSERT_EQUAL_UINT32(19, getAuditRecordBitsV2(records[0]));
+    uint8_t length = encodeAuditFrameV2(buffer, records, 1, false, FRAME_TIME);
+
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(1, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_EQUAL_UINT8(AUDIT_SUCCESS, decoded[0].kind);
+    TEST_ASSERT_FALSE(decoded[0].isSystem);
+    TEST_ASSERT_TRUE(decoded[0].isRoomUser);
+    TEST_ASSERT_EQUAL_UINT16(0, decoded[0].userHash);
+}
+
+void test_hashed_user_record()
+{
+    LoginAuditRecord records[] = {record(AUDIT_FAILURE, false, false, "mallory", 300)};
+    TEST_ASSERT_EQUAL_UINT32(31, getAuditRecordBitsV2(records[0]));
+    uint8_t length = encodeAuditFrameV2(buffer, records, 1, false, FRAME_TIME);
+    TEST_ASSERT_EQUAL_UINT8(4, length);
+
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(1, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_EQUAL_UINT8(AUDIT_FAILURE, decoded[0].kind);
+    TEST_ASSERT_FALSE(decoded[0].isRoomUser);
+    TEST_ASSERT_EQUAL_UINT16(hashAuditUsername("mallory"), decoded[0].userHash);
+    TEST_ASSERT_EQUAL_UINT16(300, decoded[0].age);
+}
+
+void test_system_and_lockout_records()
+{
+    LoginAuditRecord records[] = {
+        record(AUDIT_SUCCESS, true, false, "system", 120), // Startup
+        record(AUDIT_LOCKOUT, true, false, "system", 60),
+    };
+    TEST_ASSERT_EQUAL_UINT32(18, getAuditRecordBitsV2(records[0]));
+    uint8_t length = encodeAuditFrameV2(buffer, records, 2, false, FRAME_TIME);
+    TEST_ASSERT_EQUAL_UINT8((1 + 2 * 18 + 7) / 8, length);
+
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(2, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_TRUE(decoded[0].isSystem);
+    TEST_ASSERT_EQUAL_UINT8(AUDIT_SUCCESS, decoded[0].kind);
+    TEST_ASSERT_EQUAL_UINT16(120, decoded[0].age);
+    TEST_ASSERT_TRUE(decoded[1].isSystem);
+    TEST_ASSERT_EQUAL_UINT8(AUDIT_LOCKOUT, decoded[1].kind);
+    TEST_ASSERT_EQUAL_UINT16(60, decoded[1].age);
+}
+
+void test_age_is_capped()
+{
+    LoginAuditRecord records[] = {
+        record(AUDIT_FAILURE, false, true, "admin", 100000),
+        record(AUDIT_FAILURE, false, true, "admin", AUDIT_MAX_AGE),
+    };
+    // A timestamp after the frame time (clock stepped back) is sent as age 0
+    LoginAuditRecord future = record(AUDIT_SUCCESS, false, true, "admin", 0);
+    future.timestamp = FRAME_TIME + 10;
+
+    LoginAuditRecord all[] = {records[0], records[1], future};
+    uint8_t length = encodeAuditFrameV2(buffer, all, 3, true, FRAME_TIME);
+
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(3, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    TEST_ASSERT_EQUAL_UINT16(AUDIT_MAX_AGE, decoded[0].age);
+    TEST_ASSERT_EQUAL_UINT16(AUDIT_MAX_AGE, decoded[1].age);
+    TEST_ASSERT_EQUAL_UINT16(0, decoded[2].age);
+}
+
+void test_mixed_frame_round_trip()
+{
+    LoginAuditRecord records[] = {
+        record(AUDIT_LOCKOUT, true, false, "system", 1),
+        record(AUDIT_FAILURE, false, false, "mallory", 2),
+        record(AUDIT_SUCCESS, false, true, "admin", 3),
+        record(AUDIT_FAILURE, false, false, "eve", 4),
+    };
+    uint8_t length = encodeAuditFrameV2(buffer, records, 4, true, FRAME_TIME);
+
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(4, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT8(records[i].kind, decoded[i].kind);
+        TEST_ASSERT_EQUAL(records[i].isSystem, decoded[i].isSystem);
+        TEST_ASSERT_EQUAL(records[i].isRoomUser, decoded[i].isRoomUser);
+        TEST_ASSERT_EQUAL_UINT32(FRAME_TIME - records[i].timestamp, decoded[i].age);
+        if (!records[i].isSystem && !records[i].isRoomUser)
+        {
+            TEST_ASSERT_EQUAL_UINT16(records[i].userHash, decoded[i].userHash);
+        }
+    }
+}
+
+/**
+ * Picks records in order while they fit the data rate's payload, like serviceAuditUplink().
+ */
+static uint8_t packFrame(const LoginAuditRecord *records, uint8_t count, bool hasBase, uint8_t maxPayload)
+{
+    unsigned usedBits = getAuditHeaderBitsV2(hasBase);
+    uint8_t picked = 0;
+    while (picked < count && usedBits + getAuditRecordBitsV2(records[picked]) <= maxPayload * 8u)
+    {
+        usedBits += getAuditRecordBitsV2(records[picked]);
+        picked++;
+    }
+    return picked;
+}
+
+void test_dr0_packing()
+{
+    const uint8_t dr0 = US915_MAX_PAYLOAD[0];
+    LoginAuditRecord records[8];
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        records[i] = record(AUDIT_FAILURE, false, true, "admin", i);
+    }
+
+    // Four room-user records fit the 11 bytes of DR0 without a base, two with one
+    uint8_t picked = packFrame(records, 8, false, dr0);
+    TEST_ASSERT_EQUAL_UINT8(4, picked);
+    uint8_t length = encodeAuditFrameV2(buffer, records, picked, false, FRAME_TIME);
+    TEST_ASSERT_EQUAL_UINT8(10, length);
+    TEST_ASSERT_LESS_OR_EQUAL(dr0, length);
+
+    picked = packFrame(records, 8, true, dr0);
+    TEST_ASSERT_EQUAL_UINT8(2, picked);
+    length = encodeAuditFrameV2(buffer, records, picked, true, FRAME_TIME);
+    TEST_ASSERT_LESS_OR_EQUAL(dr0, length);
+
+    // Padding never decodes as an extra record
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(2, decodeAuditFrameV2(buffer, length, hasBase, base, decoded, 32));
+
+    // A v1 record (13 bytes) doesn't fit at all
+    TEST_ASSERT_GREATER_THAN(dr0, 13);
+}
+
+void test_truncated_frame_stops_cleanly()
+{
+    LoginAuditRecord records[] = {
+        record(AUDIT_FAILURE, false, true, "admin", 1),
+        record(AUDIT_FAILURE, false, false, "mallory", 2),
+    };
+    uint8_t length = encodeAuditFrameV2(buffer, records, 2, false, FRAME_TIME);
+
+    // Cut inside the hashed record: only the first one comes back
+    bool hasBase;
+    uint32_t base;
+    TEST_ASSERT_EQUAL_UINT8(1, decodeAuditFrameV2(buffer, length - 1, hasBase, base, decoded, 32));
+    TEST_ASSERT_EQUAL_UINT8(0, decodeAuditFrameV2(buffer, 0, hasBase, base, decoded, 32));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_hash_matches_decoder);
+    RUN_TEST(test_frame_with_base);
+    RUN_TEST(test_frame_without_base);
+    RUN_TEST(test_room_user_record);
+    RUN_TEST(test_hashed_user_record);
+    RUN_TEST(test_system_and_lockout_records);
+    RUN_TEST(test_age_is_capped);
+    RUN_TEST(test_mixed_frame_round_trip);
+    RUN_TEST(test_dr0_packing);
+    RUN_TEST(test_truncated_frame_stops_cleanly);
+    return UNITY_END();
+}